@@ -0,0 +1,152 @@
+"""Arrival-to-delivery latency of busy-poll mode versus the asyncio reader.
+
+A producer thread sends small batches over loopback TCP at a fixed interval, each stamped
+with the time.monotonic_ns() at which it was sent. For every delivered batch we record
+
+* arrival-to-delivery: from the read that completed the batch to the consumer receiving it
+* send-to-delivery: from the producer's send call to the consumer receiving it
+
+and report p50/p99/max per mode. "busy" is read_socket_busy_poll(); "asyncio" feeds a
+StreamDecoderWrapper from loop.sock_recv() and iterates an AsyncRecordBatchReader, as
+fetch_stream does.
+
+    python benchmarks/busy_poll_latency.py --batches 5000 --interval-us 200 --cpu 3
+"""
+import argparse
+import asyncio
+import socket
+import threading
+import time
+from typing import Dict, List
+
+import pyarrow as pa
+
+from common import add_result_args, flatten, percentiles, write_results
+from prototype import read_socket_busy_poll
+from prototype.prototype_cpp import StreamDecoderWrapper
+from prototype.prototype_py import AsyncRecordBatchReader
+
+# Batches delivered before measuring starts, so connection setup and allocations settle
+WARMUP = 100
+
+SCHEMA = pa.schema([("sent_ns", pa.int64()), ("value", pa.float64())])
+
+
+def connected_pair():
+    """A connected loopback TCP socket pair (SO_BUSY_POLL applies to TCP, not AF_UNIX)."""
+    with socket.create_server(("127.0.0.1", 0)) as server:
+        client = socket.create_connection(server.getsockname())
+        conn, _ = server.accept()
+    for sock in (client, conn):
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    return client, conn
+
+
+def produce(sock: socket.socket, batches: int, rows: int, interval_ns: int):
+    """Send the schema, then `batches` timestamped batches, one every interval_ns."""
+    values = pa.array([float(i) for i in range(rows)])
+    sock.sendall(SCHEMA.serialize())
+    deadline = time.monotonic_ns()
+    for _ in range(batches):
+        deadline += interval_ns
+        # Sleep most of the interval and spin the rest, for a steady send rate
+        while (remaining := deadline - time.monotonic_ns()) > 0:
+            if remaining > 200_000:
+                time.sleep((remaining - 100_000) / 1e9)
+        sent = pa.array([time.monotonic_ns()] * rows, pa.int64())
+        sock.sendall(pa.record_batch([sent, values], schema=SCHEMA).serialize())
+    sock.sendall(b"\xff\xff\xff\xff\x00\x00\x00\x00")
+    sock.close()
+
+
+def run_busy(sock: socket.socket, args) -> List[tuple]:
+    samples = []
+    for batch, arrival_ns in read_socket_busy_poll(sock, cpu=args.cpu,
+                                                   busy_poll_usec=args.busy_poll_usec):
+        delivered = time.monotonic_ns()
+        samples.append((delivered - arrival_ns, delivered - batch.column(0)[0].as_py()))
+    return samples
+
+
+def run_asyncio(sock: socket.socket, args) -> List[tuple]:
+    async def main():
+        loop = asyncio.get_running_loop()
+        sock.setblocking(False)
+        reader = AsyncRecordBatchReader()
+        wrapper = StreamDecoderWrapper()
+        # Batch callbacks run inside consume_bytes(), so arrivals line up with deliveries
+        arrivals = []
+        last_read = 0
+
+        def on_batch(ptr, schema_id):
+            arrivals.append(last_read)
+            reader._handle_batch(ptr, schema_id)
+
+        wrapper.set_batch_callback(on_batch)
+        wrapper.set_schema_callback(reader._handle_schema)
+
+        async def feed():
+            nonlocal last_read
+            while chunk := await loop.sock_recv(sock, 1 << 16):
+                last_read = time.monotonic_ns()
+                wrapper.consume_bytes(bytearray(chunk))
+            wrapper.finish(lambda error: None)  # StreamDecoderWrapper calls back right away
+            reader.mark_done()
+
+        task = asyncio.create_task(feed())
+        samples = []
+        async for batch in reader:
+            delivered = time.monotonic_ns()
+            samples.append((delivered - arrivals[len(samples)],
+                            delivered - batch.column(0)[0].as_py()))
+        await task
+        return samples
+
+    return asyncio.run(main())
+
+
+MODES = {"busy": run_busy, "asyncio": run_asyncio}
+
+
+def run(mode: str, args) -> Dict[str, Dict[str, float]]:
+    producer_sock, consumer_sock = connected_pair()
+    producer = threading.Thread(target=produce, args=(producer_sock, args.batches + WARMUP,
+                                                      args.rows, args.interval_us * 1000))
+    producer.start()
+    try:
+        samples = MODES[mode](consumer_sock, args)[WARMUP:]
+    finally:
+        producer.join()
+        consumer_sock.close()
+    # Nanosecond samples, reported in microseconds
+    return {"arrival_to_delivery_us": percentiles([s[0] for s in samples], scale=1e3),
+            "send_to_delivery_us": percentiles([s[1] for s in samples], scale=1e3)}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--batches", type=int, default=2000, help="measured batches per mode")
+    parser.add_argument("--rows", type=int, default=16, help="rows per batch")
+    parser.add_argument("--interval-us", type=int, default=500, help="time between batches")
+    parser.add_argument("--cpu", type=int, default=None, help="core for the busy-poll reader")
+    parser.add_argument("--busy-poll-usec", type=int, default=50, help="SO_BUSY_POLL time")
+    parser.add_argument("--modes", default="busy,asyncio", help="comma-separated modes to run")
+    add_result_args(parser)
+    args = parser.parse_args()
+
+    runs = []
+    print(f"{'mode':<8} {'metric':<23} {'p50 us':>10} {'p99 us':>10} {'max us':>10}")
+    for _ in range(args.repeat):
+        metrics = {}
+        for mode in args.modes.split(","):
+            metrics[mode] = run(mode, args)
+            for metric, stats in metrics[mode].items():
+                print(f"{mode:<8} {metric:<23} {stats['p50']:>10.1f} {stats['p99']:>10.1f} "
+                      f"{stats['max']:>10.1f}")
+        runs.append(flatten(metrics))
+    if args.json:
+        write_results(args.json, "busy_poll_latency", args, runs)
+
+
+if __name__ == "__main__":
+    main()
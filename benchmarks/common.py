@@ -0,0 +1,203 @@
+"""Helpers shared by the benchmarks: a local stream server, percentiles, memory usage and
+the JSON result files read by compare.py."""
+import argparse
+import contextlib
+import datetime
+import json
+import multiprocessing
+import os
+import platform
+import resource
+import socket
+import statistics
+import subprocess
+import time
+from typing import Any, Dict, Iterator, List, Optional, Sequence
+
+import pyarrow as pa
+
+
+def raise_fd_limit():
+    """Raise the soft open-file limit to the hard limit, for runs with many connections."""
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    if soft < hard:
+        resource.setrlimit(resource.RLIMIT_NOFILE, (hard, hard))
+
+
+def rss_bytes() -> int:
+    """Current resident set size of this process."""
+    with open("/proc/self/statm") as f:
+        return int(f.read().split()[1]) * os.sysconf("SC_PAGE_SIZE")
+
+
+def percentiles(values: Sequence[float], scale: float = 1.0) -> Dict[str, float]:
+    """p50, p99 and max of values, each divided by scale."""
+    if len(values) < 2:
+        value = values[0] / scale if values else float("nan")
+        return {"p50": value, "p99": value, "max": value}
+    cuts = statistics.quantiles(values, n=100, method="inclusive")
+    return {"p50": cuts[49] / scale, "p99": cuts[98] / scale, "max": max(values) / scale}
+
+
+def make_table(rows: int, batch_rows: int) -> pa.Table:
+    """A table of int64, float64 and short string columns in batch_rows-row batches."""
+    table = pa.table({
+        "id": pa.array(range(rows), pa.int64()),
+        "value": pa.array([i * 0.5 for i in range(rows)], pa.float64()),
+        "name": pa.array([f"row-{i % 1000}" for i in range(rows)]),
+    })
+    return pa.Table.from_batches(table.to_batches(max_chunksize=batch_rows))
+
+
+def _serve(port: int, rows: int, batch_rows: int):
+    import asyncio
+    from aiohttp import web
+    from prototype import ArrowStreamServer
+
+    raise_fd_limit()
+    table = make_table(rows, batch_rows)
+    server = ArrowStreamServer()
+    server.cache("table", table)
+
+    async def paced(request: web.Request) -> web.StreamResponse:
+        interval = float(request.query.get("interval_ms", 0)) / 1e3
+
+        async def batches():
+            for batch in table.to_batches():
+                yield batch
+                await asyncio.sleep(interval)
+        return await server.stream(request, batches(), table.schema)
+
+    app = web.Application()
+    app.router.add_get("/stream", lambda request: server.stream(request, table))
+    app.router.add_get("/paced", paced)
+    app.router.add_get("/cached/{name}", server.handle_cached)
+    web.run_app(app, host="127.0.0.1", port=port, reuse_port=True, print=None,
+                handle_signals=True, access_log=None)
+
+
+@contextlib.contextmanager
+def stream_server(rows: int, batch_rows: int, processes: int = 1) -> Iterator[str]:
+    """Run ArrowStreamServer in `processes` processes sharing a port (SO_REUSEPORT).
+
+    Yields the base URL. /stream encodes a make_table() table with ArrowStreamServer.stream(),
+    writing the buffers of each batch through aiohttp, /paced?interval_ms=N sends one of its
+    batches every N ms, and /cached/table serves it from a cached file as a FileResponse.
+    """
+    with socket.socket() as probe:
+        probe.bind(("127.0.0.1", 0))
+        port = probe.getsockname()[1]
+    context = multiprocessing.get_context("spawn")
+    workers = [context.Process(target=_serve, args=(port, rows, batch_rows), daemon=True)
+               for _ in range(processes)]
+    for worker in workers:
+        worker.start()
+    try:
+        deadline = time.monotonic() + 30
+        while True:
+            try:
+                socket.create_connection(("127.0.0.1", port), timeout=1).close()
+                break
+            except OSError:
+                if time.monotonic() > deadline:
+                    raise RuntimeError("stream server did not start")
+                time.sleep(0.1)
+        yield f"http://127.0.0.1:{port}"
+    finally:
+        for worker in workers:
+            worker.terminate()
+        for worker in workers:
+            worker.join()
+
+
+def add_result_args(parser: argparse.ArgumentParser):
+    """Add the --repeat and --json options every benchmark supports."""
+    parser.add_argument("--repeat", type=int, default=1,
+                        help="number of runs; compare.py needs at least 2 for confidence intervals")
+    parser.add_argument("--json", help="file to write the config and every run's metrics to")
+
+
+def flatten(metrics: Dict[str, Any], prefix: str = "") -> Dict[str, float]:
+    """Flatten nested metric dicts into {"a/b/c": value}."""
+    flat = {}
+    for key, value in metrics.items():
+        name = f"{prefix}{key}"
+        if isinstance(value, dict):
+            flat.update(flatten(value, f"{name}/"))
+        else:
+            flat[name] = float(value)
+    return flat
+
+
+def higher_is_better(metric: str) -> bool:
+    """Throughputs (names ending in _per_s) and instructions per cycle improve upwards;
+    latencies, memory, CPU and counter ratios down."""
+    name = metric.split("/")[-1]
+    return name.endswith("_per_s") or name == "instructions_per_cycle"
+
+
+def perf_ratios(counters: Dict[str, Dict[str, int]]) -> Dict[str, Dict[str, float]]:
+    """Per-unit ratios of StreamDecoderWrapper.perf_counters() totals.
+
+    Each event of the "consume" region is divided by its bytes and each event of the "export"
+    region by its batches (e.g. cycles_per_byte, cache_misses_per_batch), plus
+    instructions_per_cycle where both are counted. Many cache misses per byte at a low IPC
+    point at memory-bound decoding; many instructions per byte at a high IPC at extra work.
+    """
+    ratios = {}
+    for region, totals in counters.items():
+        unit, per = ("bytes", "byte") if "bytes" in totals else ("batches", "batch")
+        events = {k: v for k, v in totals.items() if k not in ("calls", unit)}
+        region_ratios = {f"{event}_per_{per}": value / max(totals[unit], 1)
+                         for event, value in events.items()}
+        if events.get("cycles") and "instructions" in events:
+            region_ratios["instructions_per_cycle"] = events["instructions"] / events["cycles"]
+        ratios[region] = region_ratios
+    return ratios
+
+
+def _commit() -> Optional[Dict[str, Any]]:
+    repo = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    try:
+        sha = subprocess.run(["git", "rev-parse", "HEAD"], cwd=repo, capture_output=True,
+                             text=True, check=True).stdout.strip()
+        status = subprocess.run(["git", "status", "--porcelain", "--untracked-files=no"],
+                                cwd=repo, capture_output=True, text=True, check=True).stdout
+    except (OSError, subprocess.CalledProcessError):
+        return None
+    return {"sha": sha, "dirty": bool(status.strip())}
+
+
+def _environment() -> Dict[str, Any]:
+    from prototype import arrow_version
+
+    cpu = platform.processor()
+    try:
+        with open("/proc/cpuinfo") as f:
+            cpu = next(line.split(":", 1)[1].strip() for line in f if line.startswith("model name"))
+    except (OSError, StopIteration):
+        pass
+    return {
+        "host": platform.node(),
+        "platform": platform.platform(),
+        "cpu": cpu,
+        "cpu_count": os.cpu_count(),
+        "python": platform.python_version(),
+        "pyarrow": pa.__version__,
+        "arrow_cpp_major": arrow_version(),
+    }
+
+
+def write_results(path: str, benchmark: str, args: argparse.Namespace,
+                  runs: List[Dict[str, float]]):
+    """Write a result file: the benchmark, environment, commit, config and each run's metrics."""
+    result = {
+        "benchmark": benchmark,
+        "time": datetime.datetime.now(datetime.timezone.utc).isoformat(),
+        "environment": _environment(),
+        "commit": _commit(),
+        "config": {key: value for key, value in vars(args).items() if key != "json"},
+        "runs": runs,
+    }
+    with open(path, "w") as f:
+        json.dump(result, f, indent=2)
@@ -0,0 +1,138 @@
+"""Compare two benchmark result files written with --json.
+
+For every metric in both files, prints the mean of each result set and the relative change,
+with a confidence interval for the change. The interval is Welch's t-interval on the
+difference of means, so it needs at least two runs (--repeat) on each side. A change counts
+as a regression or an improvement only if its confidence interval excludes zero and it is
+larger than --threshold. Throughputs (metrics ending in _per_s) are better when higher; all
+other metrics (latency, memory, CPU) are better when lower.
+
+The exit status is 1 if any metric regressed, so the command can gate CI:
+
+    python benchmarks/scalability.py --repeat 5 --json base.json
+    # ... change the code ...
+    python benchmarks/scalability.py --repeat 5 --json new.json
+    python benchmarks/compare.py base.json new.json --threshold 3
+"""
+import argparse
+import json
+import math
+import re
+import statistics
+import sys
+from typing import Dict, List, Optional, Tuple
+
+from common import higher_is_better
+
+
+def t_quantile(p: float, df: float) -> float:
+    """Quantile of Student's t distribution (Cornish-Fisher expansion around the normal)."""
+    z = statistics.NormalDist().inv_cdf(p)
+    if math.isinf(df):
+        return z
+    g1 = (z ** 3 + z) / 4
+    g2 = (5 * z ** 5 + 16 * z ** 3 + 3 * z) / 96
+    g3 = (3 * z ** 7 + 19 * z ** 5 + 17 * z ** 3 - 15 * z) / 384
+    g4 = (79 * z ** 9 + 776 * z ** 7 + 1482 * z ** 5 - 1920 * z ** 3 - 945 * z) / 92160
+    return z + g1 / df + g2 / df ** 2 + g3 / df ** 3 + g4 / df ** 4
+
+
+def difference_interval(base: List[float], new: List[float],
+                        confidence: float) -> Optional[Tuple[float, float]]:
+    """Welch's confidence interval for mean(new) - mean(base); None with fewer than 2 runs."""
+    if len(base) < 2 or len(new) < 2:
+        return None
+    var_base = statistics.variance(base) / len(base)
+    var_new = statistics.variance(new) / len(new)
+    se = math.sqrt(var_base + var_new)
+    diff = statistics.fmean(new) - statistics.fmean(base)
+    if se == 0:
+        return diff, diff
+    df = se ** 4 / (var_base ** 2 / (len(base) - 1) + var_new ** 2 / (len(new) - 1))
+    margin = t_quantile(0.5 + confidence / 2, df) * se
+    return diff - margin, diff + margin
+
+
+def load(path: str) -> Dict:
+    with open(path) as f:
+        return json.load(f)
+
+
+def metric_values(result: Dict) -> Dict[str, List[float]]:
+    values: Dict[str, List[float]] = {}
+    for run in result["runs"]:
+        for metric, value in run.items():
+            values.setdefault(metric, []).append(value)
+    return values
+
+
+def describe_differences(base: Dict, new: Dict):
+    """Print what differs between the two result sets besides the code."""
+    if base["benchmark"] != new["benchmark"]:
+        print(f"warning: comparing {base['benchmark']} with {new['benchmark']}")
+    for section in ("config", "environment"):
+        for key in sorted(set(base[section]) | set(new[section])):
+            if key != "repeat" and base[section].get(key) != new[section].get(key):
+                print(f"note: {section}.{key}: {base[section].get(key)!r} -> {new[section].get(key)!r}")
+    print(f"commits: {commit_label(base)} -> {commit_label(new)}\n")
+
+
+def commit_label(result: Dict) -> str:
+    commit = result.get("commit") or {}
+    return commit.get("sha", "unknown")[:12] + ("+dirty" if commit.get("dirty") else "")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("base", help="result file of the baseline")
+    parser.add_argument("new", help="result file to compare against the baseline")
+    parser.add_argument("--threshold", type=float, default=5.0,
+                        help="smallest relative change, in percent, that is flagged")
+    parser.add_argument("--confidence", type=float, default=0.95, help="confidence level")
+    parser.add_argument("--metrics", help="regular expression selecting the metrics to compare")
+    parser.add_argument("--changed-only", action="store_true",
+                        help="only list regressions and improvements")
+    args = parser.parse_args()
+
+    base, new = load(args.base), load(args.new)
+    describe_differences(base, new)
+    base_values, new_values = metric_values(base), metric_values(new)
+    metrics = [m for m in base_values if m in new_values
+               and (not args.metrics or re.search(args.metrics, m))]
+
+    regressions = 0
+    width = max([len(m) for m in metrics] + [6])
+    level = f"{args.confidence:.0%} CI"
+    print(f"{'metric':<{width}} {'base':>12} {'new':>12} {'change':>8} {level:>20}  verdict")
+    for metric in metrics:
+        mean_base = statistics.fmean(base_values[metric])
+        mean_new = statistics.fmean(new_values[metric])
+        interval = difference_interval(base_values[metric], new_values[metric], args.confidence)
+        if mean_base == 0:
+            change, ci_text, verdict = float("nan"), "n/a", ""
+        else:
+            change = 100 * (mean_new - mean_base) / abs(mean_base)
+            verdict = ""
+            ci_text = "n/a (need 2+ runs)"
+            if interval is not None:
+                low, high = (100 * bound / abs(mean_base) for bound in interval)
+                ci_text = f"[{low:+.1f}%, {high:+.1f}%]"
+                significant = low > 0 or high < 0
+                if significant and abs(change) >= args.threshold:
+                    worse = change < 0 if higher_is_better(metric) else change > 0
+                    verdict = "REGRESSION" if worse else "improvement"
+                    regressions += worse
+        if args.changed_only and not verdict:
+            continue
+        print(f"{metric:<{width}} {mean_base:>12.4g} {mean_new:>12.4g} {change:>+7.1f}% "
+              f"{ci_text:>20}  {verdict}")
+
+    missing = sorted(set(base_values) ^ set(new_values))
+    if missing:
+        print(f"\n{len(missing)} metrics are only in one of the files")
+    print(f"\n{regressions} regression(s)")
+    sys.exit(1 if regressions else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,81 @@
+"""Decode throughput of StreamDecoderWrapper, optionally with hardware event counts.
+
+An in-memory IPC stream (see common.make_table) is fed to consume_bytes() in chunks of each
+given size, with a batch callback that imports every batch into pyarrow, as the readers do.
+Reports MB/s and batches/s per chunk size. With --perf the wrapper also counts cycles,
+instructions, cache misses, branch misses and page faults (perf_event_open) around each
+consumed chunk and each exported batch, reported per byte and per batch; see
+common.perf_ratios for how to read them. Counting reads the counters twice per call, so
+throughput is lower with --perf; compare runs with the same setting.
+
+    python benchmarks/decode.py --chunk-kb 4,64,1024 --perf
+"""
+import argparse
+import time
+from typing import Dict, List
+
+import pyarrow as pa
+
+from common import add_result_args, flatten, make_table, perf_ratios, write_results
+from prototype.prototype_cpp import StreamDecoderWrapper
+from prototype.prototype_py import _interned_schema
+
+
+def serialize(table: pa.Table) -> bytes:
+    sink = pa.BufferOutputStream()
+    with pa.ipc.new_stream(sink, table.schema) as writer:
+        writer.write_table(table)
+    return sink.getvalue().to_pybytes()
+
+
+def decode(chunks: List[bytes], perf: bool) -> Dict[str, object]:
+    wrapper = StreamDecoderWrapper()
+    batches = []
+    wrapper.set_schema_callback(lambda schema_id: None)
+    wrapper.set_batch_callback(lambda ptr, schema_id: batches.append(
+        pa.RecordBatch._import_from_c(ptr, _interned_schema(schema_id))))
+    if perf:
+        wrapper.enable_perf_counters()
+    start = time.perf_counter()
+    for chunk in chunks:
+        wrapper.consume_bytes(chunk)
+    elapsed = time.perf_counter() - start
+    wrapper.finish(lambda error: None)  # StreamDecoderWrapper calls back right away
+    nbytes = sum(len(chunk) for chunk in chunks)
+    result = {"mb_per_s": nbytes / elapsed / 1e6, "batches_per_s": len(batches) / elapsed}
+    if perf:
+        result.update(perf_ratios(wrapper.perf_counters()))
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--chunk-kb", default="4,64,1024",
+                        help="comma-separated sizes of the chunks passed to consume_bytes()")
+    parser.add_argument("--rows", type=int, default=2_000_000, help="rows in the stream")
+    parser.add_argument("--batch-rows", type=int, default=10_000, help="rows per batch")
+    parser.add_argument("--perf", action="store_true",
+                        help="count hardware events around consume_bytes() and batch export")
+    add_result_args(parser)
+    args = parser.parse_args()
+
+    data = serialize(make_table(args.rows, args.batch_rows))
+    runs = []
+    for _ in range(args.repeat):
+        metrics = {}
+        for size in (int(kb) * 1024 for kb in args.chunk_kb.split(",")):
+            chunks = [data[i:i + size] for i in range(0, len(data), size)]
+            r = metrics[f"chunk_kb={size // 1024}"] = decode(chunks, args.perf)
+            print(f"chunk {size // 1024:>6} KiB {r['mb_per_s']:>9.1f} MB/s "
+                  f"{r['batches_per_s']:>10.0f} batches/s")
+            for region in ("consume", "export"):
+                if region in r:
+                    print(f"  {region:<8} " + "  ".join(f"{name} {value:.4g}"
+                                                     for name, value in r[region].items()))
+        runs.append(flatten(metrics))
+    if args.json:
+        write_results(args.json, "decode", args, runs)
+
+
+if __name__ == "__main__":
+    main()
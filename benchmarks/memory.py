@@ -0,0 +1,120 @@
+"""Peak memory of a slow consumer across producer rates and reader configurations.
+
+The consumer in example.py sleeps for every batch; when the producer is faster, decoded
+batches pile up in the reader. For every combination of reader configuration, producer
+interval and consumer delay, one stream is read in a fresh process while a sampler records
+
+* RSS of the process
+* bytes allocated from Arrow's default memory pool
+* reader queue depth (batches) and queued in-memory batch bytes
+
+over time. The peaks are printed; --series writes every sample to a CSV file.
+
+    python benchmarks/memory.py --intervals-ms 0,1 --delays-ms 0,1,10 --configs default,spill
+"""
+import argparse
+import asyncio
+import concurrent.futures
+import csv
+import multiprocessing
+import time
+from typing import Dict, List
+
+import pyarrow as pa
+
+from common import add_result_args, flatten, rss_bytes, stream_server, write_results
+from prototype import fetch_stream
+
+# fetch_stream() keyword arguments per reader configuration
+CONFIGS: Dict[str, Dict[str, object]] = {
+    "default": {},
+    "spill": {"spill_threshold": 32 << 20},
+    "compress": {"compress_depth": 16},
+}
+
+# Time between samples
+SAMPLE_INTERVAL = 0.02
+
+
+async def sample(reader, samples: List[Dict[str, float]], start: float, stop: asyncio.Event):
+    while not stop.is_set():
+        samples.append({
+            "seconds": time.perf_counter() - start,
+            "rss_bytes": rss_bytes(),
+            "pool_bytes": pa.total_allocated_bytes(),
+            "queue_depth": reader._queue.qsize(),
+            "queued_bytes": reader._queued_bytes,
+        })
+        await asyncio.sleep(SAMPLE_INTERVAL)
+
+
+async def consume(url: str, delay: float, config: str) -> List[Dict[str, float]]:
+    start = time.perf_counter()
+    reader = await fetch_stream(url, **CONFIGS[config])
+    samples: List[Dict[str, float]] = []
+    stop = asyncio.Event()
+    sampler = asyncio.create_task(sample(reader, samples, start, stop))
+    async for _ in reader:
+        await asyncio.sleep(delay)
+    stop.set()
+    await sampler
+    return samples
+
+
+def run(url: str, delay: float, config: str) -> List[Dict[str, float]]:
+    return asyncio.run(consume(url, delay, config))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--intervals-ms", default="0,1,5",
+                        help="comma-separated producer intervals between batches; 0 is unpaced")
+    parser.add_argument("--delays-ms", default="0,1,10",
+                        help="comma-separated consumer processing delays per batch")
+    parser.add_argument("--configs", default=",".join(CONFIGS),
+                        help=f"comma-separated reader configurations: {', '.join(CONFIGS)}")
+    parser.add_argument("--rows", type=int, default=2_000_000, help="rows per stream")
+    parser.add_argument("--batch-rows", type=int, default=10_000, help="rows per batch")
+    parser.add_argument("--series", help="CSV file to write every sample to")
+    add_result_args(parser)
+    args = parser.parse_args()
+
+    rows = []
+    runs = []
+    print(f"{'config':<9} {'interval':>8} {'delay':>6} {'seconds':>8} {'RSS MB':>8} "
+          f"{'pool MB':>8} {'depth':>6} {'queued MB':>10}")
+    with stream_server(args.rows, args.batch_rows) as base_url:
+        for repeat in range(args.repeat):
+            metrics = {}
+            for config in args.configs.split(","):
+                for interval in (float(v) for v in args.intervals_ms.split(",")):
+                    for delay in (float(v) for v in args.delays_ms.split(",")):
+                        url = f"{base_url}/paced?interval_ms={interval}" if interval else f"{base_url}/stream"
+                        # A fresh process per run, since freed memory is not returned to the OS
+                        with concurrent.futures.ProcessPoolExecutor(
+                                1, mp_context=multiprocessing.get_context("spawn")) as pool:
+                            samples = pool.submit(run, url, delay / 1e3, config).result()
+                        peak = {key: max(s[key] for s in samples) for key in samples[0]}
+                        print(f"{config:<9} {interval:>8g} {delay:>6g} {peak['seconds']:>8.2f} "
+                              f"{peak['rss_bytes'] / 1e6:>8.1f} {peak['pool_bytes'] / 1e6:>8.1f} "
+                              f"{peak['queue_depth']:>6} {peak['queued_bytes'] / 1e6:>10.1f}")
+                        metrics[f"{config}/interval_ms={interval:g}/delay_ms={delay:g}"] = {
+                            "peak_rss_mb": peak["rss_bytes"] / 1e6,
+                            "peak_pool_mb": peak["pool_bytes"] / 1e6,
+                            "peak_queue_depth": peak["queue_depth"],
+                            "peak_queued_mb": peak["queued_bytes"] / 1e6,
+                        }
+                        rows += [{"repeat": repeat, "config": config, "interval_ms": interval,
+                                  "delay_ms": delay, **s} for s in samples]
+            runs.append(flatten(metrics))
+    if args.json:
+        write_results(args.json, "memory", args, runs)
+    if args.series:
+        with open(args.series, "w", newline="") as f:
+            writer = csv.DictWriter(f, fieldnames=list(rows[0]))
+            writer.writeheader()
+            writer.writerows(rows)
+
+
+if __name__ == "__main__":
+    main()
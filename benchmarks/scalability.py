@@ -0,0 +1,115 @@
+"""Scalability of concurrent fetch_stream() readers.
+
+Starts the local ArrowStreamServer (see common.stream_server) and, for each concurrency
+level, reads that many streams at once, each to the end. Per level it reports
+
+* aggregate throughput, in decoded MB/s and rows/s
+* per-stream latency: time to first batch and time to the end of the stream (p50/p99)
+* event-loop lag: how late a 10 ms timer fires while the readers run (p99/max)
+* peak RSS and the CPU time of this process (user + system, as a share of one core)
+
+Contention in the callback and queue design shows up as throughput flattening while
+loop lag and per-stream latency grow.
+
+    python benchmarks/scalability.py --levels 1,10,100,1000 --server-processes 4
+"""
+import argparse
+import asyncio
+import resource
+import time
+from typing import Dict, List
+
+from common import (add_result_args, flatten, percentiles, raise_fd_limit, rss_bytes,
+                    stream_server, write_results)
+from prototype import fetch_stream
+
+# Interval of the event-loop lag probe
+LAG_INTERVAL = 0.01
+
+
+async def read_one(url: str, transport: str) -> Dict[str, float]:
+    start = time.perf_counter()
+    reader = await fetch_stream(url, transport=transport)
+    first = None
+    rows = nbytes = 0
+    async for batch in reader:
+        if first is None:
+            first = time.perf_counter()
+        rows += batch.num_rows
+        nbytes += batch.nbytes
+    end = time.perf_counter()
+    return {"first_batch": (first or end) - start, "total": end - start,
+            "rows": rows, "bytes": nbytes}
+
+
+async def monitor(lags: List[float], peak_rss: List[int], stop: asyncio.Event):
+    """Record how late each LAG_INTERVAL sleep wakes up, and the peak RSS."""
+    while not stop.is_set():
+        expected = time.perf_counter() + LAG_INTERVAL
+        await asyncio.sleep(LAG_INTERVAL)
+        lags.append(max(0.0, time.perf_counter() - expected))
+        peak_rss[0] = max(peak_rss[0], rss_bytes())
+
+
+async def run_level(url: str, streams: int, transport: str) -> Dict[str, object]:
+    lags: List[float] = []
+    peak_rss = [rss_bytes()]
+    stop = asyncio.Event()
+    probe = asyncio.create_task(monitor(lags, peak_rss, stop))
+    usage = resource.getrusage(resource.RUSAGE_SELF)
+    start = time.perf_counter()
+    results = await asyncio.gather(*(read_one(url, transport) for _ in range(streams)))
+    elapsed = time.perf_counter() - start
+    after = resource.getrusage(resource.RUSAGE_SELF)
+    stop.set()
+    await probe
+
+    cpu = (after.ru_utime - usage.ru_utime) + (after.ru_stime - usage.ru_stime)
+    return {
+        "seconds": elapsed,
+        "mb_per_s": sum(r["bytes"] for r in results) / elapsed / 1e6,
+        "rows_per_s": sum(r["rows"] for r in results) / elapsed,
+        "first_batch_ms": percentiles([r["first_batch"] for r in results], scale=1e-3),
+        "stream_ms": percentiles([r["total"] for r in results], scale=1e-3),
+        "loop_lag_ms": percentiles(lags, scale=1e-3),
+        "peak_rss_mb": peak_rss[0] / 1e6,
+        "cpu_percent": 100 * cpu / elapsed,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--levels", default="1,10,50,100,250,500,1000",
+                        help="comma-separated numbers of concurrent streams")
+    parser.add_argument("--rows", type=int, default=100_000, help="rows per stream")
+    parser.add_argument("--batch-rows", type=int, default=10_000, help="rows per batch")
+    parser.add_argument("--transport", default="aiohttp", help="fetch_stream transport")
+    parser.add_argument("--route", default="stream", choices=["stream", "cached/table"],
+                        help="server path: encode per request, or serve the cached file")
+    parser.add_argument("--server-processes", type=int, default=1,
+                        help="server processes sharing the port, so the server keeps up")
+    add_result_args(parser)
+    args = parser.parse_args()
+    raise_fd_limit()
+
+    print(f"{'streams':>7} {'MB/s':>8} {'Mrows/s':>8} {'first p50':>10} {'first p99':>10} "
+          f"{'end p50':>9} {'end p99':>9} {'lag p99':>8} {'lag max':>8} {'RSS MB':>8} {'CPU %':>6}")
+    runs = []
+    with stream_server(args.rows, args.batch_rows, args.server_processes) as base_url:
+        url = f"{base_url}/{args.route}"
+        for _ in range(args.repeat):
+            metrics = {}
+            for streams in (int(level) for level in args.levels.split(",")):
+                r = metrics[f"streams={streams}"] = asyncio.run(run_level(url, streams, args.transport))
+                print(f"{streams:>7} {r['mb_per_s']:>8.1f} {r['rows_per_s'] / 1e6:>8.2f} "
+                      f"{r['first_batch_ms']['p50']:>10.1f} {r['first_batch_ms']['p99']:>10.1f} "
+                      f"{r['stream_ms']['p50']:>9.1f} {r['stream_ms']['p99']:>9.1f} "
+                      f"{r['loop_lag_ms']['p99']:>8.1f} {r['loop_lag_ms']['max']:>8.1f} "
+                      f"{r['peak_rss_mb']:>8.1f} {r['cpu_percent']:>6.0f}")
+            runs.append(flatten(metrics))
+    if args.json:
+        write_results(args.json, "scalability", args, runs)
+
+
+if __name__ == "__main__":
+    main()
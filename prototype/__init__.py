@@ -1,4 +1,6 @@
 from .prototype_cpp import arrow_version
-from .prototype_py import fetch_stream
+from .prototype_py import (ArrowStreamServer, AsyncRecordBatchWriter, StreamDataset, execute_plan,
+                           execute_substrait, fetch_stream, read_socket_busy_poll)
 
-__all__ = ["arrow_version", "fetch_stream"]
+__all__ = ["arrow_version", "ArrowStreamServer", "AsyncRecordBatchWriter", "StreamDataset",
+           "execute_plan", "execute_substrait", "fetch_stream", "read_socket_busy_poll"]
@@ -0,0 +1,486 @@
+import asyncio
+import errno
+import socket
+import ssl
+from typing import Dict, Optional, Set, Tuple
+from urllib.parse import urljoin, urlsplit
+
+from .prototype_cpp import StreamDecoderWrapper
+
+# Smallest buffer handed to the transport. Message metadata is only a few hundred bytes, so
+# sizing purely from the decoder's next required size would mean one syscall per prefix.
+_MIN_BUFFER_SIZE = 64 * 1024
+# Upper bound on the HTTP response head and on a single chunk-size line
+_MAX_HEAD_SIZE = 64 * 1024
+_MAX_CHUNK_LINE = 1024
+_REDIRECT_STATUSES = (301, 302, 303, 307, 308)
+
+# Kernel TLS (linux/tls.h): the socket option level, the TLS_RX option that holds the receive
+# keys once offloaded, and the control message carrying the type of each received record
+_SOL_TLS = 282
+_TLS_RX = 2
+_TLS_GET_RECORD_TYPE = 2
+_TCP_ULP = 31
+_TLS_RECORD_ALERT = 21
+_TLS_RECORD_APPLICATION_DATA = 23
+# ssl.OP_ENABLE_KTLS on Python 3.12+; the same bit in OpenSSL 3.x
+_OP_ENABLE_KTLS = getattr(ssl, "OP_ENABLE_KTLS", 1 << 3)
+# Whether the kernel has TLS support: None until probed
+_ktls_usable: Optional[bool] = None
+# (host, port) of servers whose connections the kernel could not take over, usually because
+# of the cipher they negotiate; later connections to them use the event loop's SSL transport
+_ktls_refused: Set[Tuple[str, int]] = set()
+
+
+class ArrowStreamProtocol(asyncio.BufferedProtocol):
+    """HTTP/1.1 response protocol that receives the body directly into decoder buffers.
+
+    ``get_buffer()`` hands the event loop the unfilled tail of a buffer owned by
+    StreamDecoderWrapper, sized from the decoder's next required size, and ``buffer_updated()``
+    commits the received bytes; the decoder takes the buffer once it holds what it needs, so
+    a message body spanning many reads still lands in one allocation. The kernel therefore
+    writes straight into the buffers that become Arrow column data, with no intermediate
+    ``bytes`` object per read. Works with any event loop that
+    implements ``BufferedProtocol`` (the default loop and uvloop).
+
+    Chunked transfer encoding is removed in place, so only chunk boundaries cost a copy.
+    Reading is paused while the wrapper reports a full input queue (see
+    TextStreamReader.queue_full), so TCP flow control holds back a server that outpaces it.
+    """
+
+    def __init__(self, wrapper: StreamDecoderWrapper, reader, request: bytes,
+                 min_buffer_size: int = _MIN_BUFFER_SIZE):
+        loop = asyncio.get_running_loop()
+        self._loop = loop
+        self._wrapper = wrapper
+        self._reader = reader
+        self._request = request
+        self._min_buffer_size = min_buffer_size
+        self._transport: Optional[asyncio.Transport] = None
+        self.head = loop.create_future()        # resolves to (status, headers) once parsed
+        self.done = loop.create_future()        # resolves once the body has been fully decoded
+
+        self._head_buf = bytearray()            # response head received so far
+        self._scratch = bytearray(8192)         # receive buffer used until the body starts
+        self._view: Optional[memoryview] = None # view over the decoder buffer being filled
+        self._discard = False                   # true for non-2xx responses; the body is ignored
+
+        self._framing = "close"                 # one of "close", "length", "chunked"
+        self._remaining = 0                     # body bytes left when framing is "length"
+        self._chunk_remaining = 0               # payload bytes left in the current chunk
+        self._chunk_line = bytearray()          # partially received chunk-size line
+        self._body_done = False
+        self._finishing = False                 # true once wrapper.finish() has been called
+        wrapper.set_drain_callback(lambda: loop.call_soon_threadsafe(self._resume_reading))
+
+    def connection_made(self, transport):
+        self._transport = transport
+        transport.write(self._request)
+
+    def get_buffer(self, sizehint):
+        if not self.head.done() or self._discard:
+            return self._scratch
+        self._view = memoryview(self._wrapper.get_buffer(self._min_buffer_size))
+        return self._view
+
+    def buffer_updated(self, nbytes):
+        try:
+            if not self.head.done():
+                self._head_updated(nbytes)
+            elif not self._discard:
+                view, self._view = self._view, None
+                self._body_updated(view, nbytes)
+        except Exception as e:
+            self._fail(e)
+
+    def eof_received(self):
+        if self._framing == "close" and self.head.done():
+            self._finish()
+        return False
+
+    def connection_lost(self, exc):
+        if not self.head.done():
+            self.head.set_exception(exc or ConnectionError("connection closed before response head"))
+        if not self.done.done() and not self._finishing:
+            if self._discard or (self._framing == "close" and exc is None):
+                self._finish()
+            else:
+                self._fail(exc or ConnectionError("connection closed before end of stream"))
+
+    def _head_updated(self, nbytes):
+        self._head_buf += self._scratch[:nbytes]
+        end = self._head_buf.find(b"\r\n\r\n")
+        if end < 0:
+            if len(self._head_buf) > _MAX_HEAD_SIZE:
+                raise ValueError("HTTP response head too large")
+            return
+        status, headers = _parse_head(bytes(self._head_buf[:end]))
+        leftover = self._head_buf[end + 4:]
+        self._head_buf = bytearray()
+
+        if not 200 <= status < 300:
+            self._discard = True
+        elif headers.get("content-encoding", "identity") != "identity":
+            raise ValueError(f"unsupported content-encoding: {headers['content-encoding']}")
+        elif "chunked" in headers.get("transfer-encoding", ""):
+            self._framing = "chunked"
+        elif "content-length" in headers:
+            self._framing = "length"
+            self._remaining = int(headers["content-length"])
+        self.head.set_result((status, headers))
+
+        if self._discard:
+            return
+        if self._framing == "length" and self._remaining == 0:
+            self._finish()
+        elif leftover:
+            # The tail of the first read is small; copying it into the decoder is fine
+            self._body_updated(memoryview(leftover), len(leftover), owned=False)
+
+    def _body_updated(self, view: memoryview, nbytes: int, owned: bool = True):
+        if self._framing == "chunked":
+            nbytes = self._dechunk(view, nbytes)
+        elif self._framing == "length":
+            nbytes = min(nbytes, self._remaining)
+            self._remaining -= nbytes
+            self._body_done = self._remaining == 0
+
+        if owned:
+            self._wrapper.commit_buffer(nbytes)
+        elif nbytes:
+            self._wrapper.consume_bytes(bytearray(view[:nbytes]))
+
+        if self._body_done:
+            self._finish()
+        elif self._wrapper.queue_full():
+            self._transport.pause_reading()
+
+    def _resume_reading(self):
+        if self._transport is not None and not self._wrapper.queue_full():
+            self._transport.resume_reading()
+
+    def _dechunk(self, view: memoryview, nbytes: int) -> int:
+        """Strip chunked transfer-encoding framing from view[:nbytes] in place.
+
+        Returns the number of payload bytes now at the front of the view.
+        """
+        read = write = 0
+        while read < nbytes and not self._body_done:
+            if self._chunk_remaining:
+                take = min(self._chunk_remaining, nbytes - read)
+                if write != read:
+                    view[write:write + take] = view[read:read + take]
+                read += take
+                write += take
+                self._chunk_remaining -= take
+                continue
+
+            # Framing between chunks: CRLF after the previous payload, then "<hex size>[;ext]\r\n"
+            limit = min(nbytes, read + _MAX_CHUNK_LINE)
+            end = bytes(view[read:limit]).find(b"\n")
+            if end < 0:
+                self._chunk_line += view[read:limit]
+                if len(self._chunk_line) > _MAX_CHUNK_LINE:
+                    raise ValueError("malformed chunked encoding")
+                read = limit
+                continue
+            self._chunk_line += view[read:read + end + 1]
+            read += end + 1
+            line = bytes(self._chunk_line).strip()
+            self._chunk_line.clear()
+            if not line:
+                continue
+            size = int(line.split(b";", 1)[0], 16)
+            if size == 0:
+                self._body_done = True  # trailers, if any, are ignored
+            else:
+                self._chunk_remaining = size
+        return write
+
+    def _finish(self):
+        if self.done.done() or self._finishing:
+            return
+        self._body_done = True
+        self._finishing = True
+        if self._discard:
+            self._finished("")
+            return
+        try:
+            # The wrapper may still be parsing; this protocol's callbacks are synchronous, so
+            # completion is picked up on the loop from the done callback
+            self._wrapper.finish(lambda error: self._loop.call_soon_threadsafe(self._finished, error))
+        except Exception as e:
+            self._fail(e)
+
+    def _finished(self, error: str):
+        if self.done.done():
+            return
+        if error:
+            self._fail(RuntimeError(error))
+            return
+        if not self._discard:
+            self._reader.mark_done()
+        self.done.set_result(None)
+        if self._transport is not None:
+            self._transport.close()
+
+    def _fail(self, exc: Exception):
+        if not self.head.done():
+            self.head.set_exception(exc)
+        if self.done.done():
+            return
+        self._reader._error = exc
+        self._reader.mark_done()
+        self.done.set_exception(exc)
+        if self._transport is not None:
+            self._transport.close()
+
+
+class KtlsSocket(socket.socket):
+    """Socket whose received TLS records are decrypted by the kernel.
+
+    ``recv_into()`` receives plaintext straight into the caller's buffer, i.e. the decoder
+    buffer handed out by ArrowStreamProtocol, so there is neither userspace decryption nor an
+    extra copy. Records other than application data are taken off the socket here: session
+    tickets are skipped and close_notify reads as EOF.
+
+    This relies on a detail of CPython's selector event loops: the transport they create for
+    ``create_connection(sock=...)`` reads by calling ``recv_into()`` on that socket object,
+    which holds for CPython 3.8 through 3.13. Other loops, such as uvloop or the proactor, read
+    the file descriptor themselves, so this is not used with them.
+    """
+
+    def recv_into(self, buffer, nbytes=0, flags=0):
+        view = memoryview(buffer).cast("B")
+        if nbytes:
+            view = view[:nbytes]
+        while True:
+            nbytes, ancdata, _, _ = self.recvmsg_into([view], socket.CMSG_SPACE(1), flags)
+            record_type = _TLS_RECORD_APPLICATION_DATA
+            for level, kind, data in ancdata:
+                if level == _SOL_TLS and kind == _TLS_GET_RECORD_TYPE:
+                    record_type = data[0]
+            if record_type == _TLS_RECORD_APPLICATION_DATA:
+                return nbytes
+            if record_type == _TLS_RECORD_ALERT:
+                if bytes(view[1:2]) == b"\x00":  # close_notify
+                    return 0
+                raise ConnectionError(f"TLS alert {bytes(view[:2]).hex()} received")
+            # Post-handshake messages such as NewSessionTicket; the next read overwrites them
+
+
+class _SslSocketTransport(asyncio.Transport):
+    """Read-only transport over an ssl.SSLSocket whose handshake and request are already done.
+
+    Used when the kernel refuses the keys after ``_connect_ktls()`` has finished the handshake,
+    so the connection is kept instead of being redone in the event loop's SSL transport.
+    ``write()`` only accepts an empty request.
+
+    Only public loop methods are used, but ``add_reader()`` needs a selector event loop, which
+    is also what kernel TLS is limited to; checked with CPython 3.8 through 3.13.
+    """
+
+    def __init__(self, loop: asyncio.AbstractEventLoop, sock: ssl.SSLSocket,
+                 protocol: asyncio.BufferedProtocol):
+        super().__init__({"socket": sock, "ssl_object": sock, "peername": sock.getpeername()})
+        sock.setblocking(False)
+        self._loop = loop
+        self._sock = sock
+        self._protocol = protocol
+        self._paused = True
+        self._closing = False
+        loop.call_soon(protocol.connection_made, self)
+        loop.call_soon(self.resume_reading)
+
+    def write(self, data):
+        if data:
+            raise RuntimeError("the request has already been sent")
+
+    def is_reading(self):
+        return not self._paused and not self._closing
+
+    def pause_reading(self):
+        if self.is_reading():
+            self._paused = True
+            self._loop.remove_reader(self._sock.fileno())
+
+    def resume_reading(self):
+        if self._paused and not self._closing:
+            self._paused = False
+            self._loop.add_reader(self._sock.fileno(), self._read_ready)
+            # Plaintext OpenSSL already decrypted does not make the socket readable again
+            self._loop.call_soon(self._read_ready)
+
+    def is_closing(self):
+        return self._closing
+
+    def close(self):
+        self._close(None)
+
+    def _close(self, exc: Optional[BaseException]):
+        if self._closing:
+            return
+        self._closing = True
+        if not self._paused:
+            self._loop.remove_reader(self._sock.fileno())
+        self._sock.close()
+        self._loop.call_soon(self._protocol.connection_lost, exc)
+
+    def _read_ready(self):
+        while self.is_reading():
+            try:
+                nbytes = self._sock.recv_into(self._protocol.get_buffer(-1))
+            except (ssl.SSLWantReadError, ssl.SSLWantWriteError, BlockingIOError):
+                return
+            except ssl.SSLZeroReturnError:
+                nbytes = 0
+            except OSError as e:
+                self._close(e)
+                return
+            if nbytes == 0:
+                if not self._protocol.eof_received():
+                    self.close()
+                return
+            self._protocol.buffer_updated(nbytes)
+            if not self._sock.pending():
+                return
+
+
+def _kernel_has_tls() -> bool:
+    """Check whether the kernel's TLS module is available, without a connection."""
+    with socket.socket() as sock:
+        try:
+            sock.setsockopt(socket.IPPROTO_TCP, _TCP_ULP, b"tls")
+        except OSError as e:
+            # An unconnected socket fails with ENOTCONN only once the "tls" ULP is found
+            return e.errno == errno.ENOTCONN
+    return True
+
+
+def _connect_ktls(host: str, port: int, ssl_context: ssl.SSLContext,
+                  request: bytes) -> socket.socket:
+    """Connect, complete the TLS handshake with kernel TLS enabled and send the request.
+
+    Blocking; meant to run on an executor. Returns a KtlsSocket if OpenSSL handed the receive
+    keys to the kernel, otherwise the connected ssl.SSLSocket, so the handshake is not wasted.
+    """
+    ssl_context.options |= _OP_ENABLE_KTLS
+    sock = socket.create_connection((host, port))
+    try:
+        tls_sock = ssl_context.wrap_socket(sock, server_hostname=host)
+    except BaseException:
+        sock.close()
+        raise
+    try:
+        # Sent through OpenSSL, which uses the kernel for this too if it offloaded transmit
+        tls_sock.sendall(request)
+    except BaseException:
+        tls_sock.close()
+        raise
+    try:
+        tls_sock.getsockopt(_SOL_TLS, _TLS_RX, 64)
+    except OSError:
+        return tls_sock
+    return KtlsSocket(fileno=tls_sock.detach())
+
+
+def _parse_head(head: bytes) -> Tuple[int, Dict[str, str]]:
+    """Parse an HTTP/1.x status line and headers. Header names are lowercased."""
+    lines = head.decode("latin-1").split("\r\n")
+    parts = lines[0].split(" ", 2)
+    if len(parts) < 2 or not parts[0].startswith("HTTP/"):
+        raise ValueError(f"malformed HTTP status line: {lines[0]!r}")
+    headers = {}
+    for line in lines[1:]:
+        name, _, value = line.partition(":")
+        headers[name.strip().lower()] = value.strip()
+    return int(parts[1]), headers
+
+
+def _build_request(url: str, ssl_context: Optional[ssl.SSLContext] = None
+                   ) -> Tuple[str, int, Optional[ssl.SSLContext], bytes]:
+    """Build the connection target and GET request for an http(s) URL.
+
+    ssl_context is used for https, or a default context if it is None.
+    """
+    parts = urlsplit(url)
+    if parts.scheme not in ("http", "https"):
+        raise ValueError(f"unsupported URL scheme for buffered transport: {parts.scheme!r}")
+    https = parts.scheme == "https"
+    port = parts.port or (443 if https else 80)
+    target = (parts.path or "/") + (f"?{parts.query}" if parts.query else "")
+    request = (
+        f"GET {target} HTTP/1.1\r\n"
+        f"Host: {parts.netloc}\r\n"
+        "Accept: application/vnd.apache.arrow.stream, */*\r\n"
+        "Accept-Encoding: identity\r\n"
+        "Connection: close\r\n"
+        "\r\n"
+    ).encode("latin-1")
+    if https and ssl_context is None:
+        ssl_context = ssl.create_default_context()
+    return parts.hostname, port, ssl_context if https else None, request
+
+
+async def read_stream_buffered(url: str, wrapper: StreamDecoderWrapper, reader,
+                               max_redirects: int = 5, ktls: bool = True,
+                               ssl_context: Optional[ssl.SSLContext] = None):
+    """Background task to read the stream with ArrowStreamProtocol
+
+    For https, kernel TLS is used when the kernel, OpenSSL and event loop support it: the
+    handshake runs in OpenSSL on an executor thread, after which the kernel decrypts the
+    response into the decoder buffers. Otherwise TLS runs in the event loop's SSL transport. A
+    server whose connection the kernel refuses, e.g. for its cipher, keeps that connection and
+    is not tried with kernel TLS again.
+
+    Parameters
+    ----------
+        url: http(s) URL to fetch Arrow IPC stream from
+        wrapper: StreamDecoderWrapper or TextStreamReader instance that owns the receive buffers
+        reader: AsyncRecordBatchReader to receive batches
+        max_redirects: maximum number of 3xx redirects to follow
+        ktls: if False, never use kernel TLS
+        ssl_context: context for https; None uses the default certificate checks. Kernel TLS
+            enables ssl.OP_ENABLE_KTLS on it
+
+    Raises
+    ------
+        Exception: Any error during stream reading is caught and stored in reader
+    """
+    global _ktls_usable
+    loop = asyncio.get_running_loop()
+    if ktls and _ktls_usable is None:
+        _ktls_usable = _kernel_has_tls()
+    ktls = ktls and _ktls_usable and isinstance(loop, asyncio.selector_events.BaseSelectorEventLoop)
+    try:
+        for _ in range(max_redirects + 1):
+            host, port, context, request = _build_request(url, ssl_context)
+            if context is not None and ktls and (host, port) not in _ktls_refused:
+                sock = await loop.run_in_executor(
+                    None, _connect_ktls, host, port, context, request)
+                # The request has gone out right after the handshake
+                protocol = ArrowStreamProtocol(wrapper, reader, b"")
+                if isinstance(sock, ssl.SSLSocket):
+                    _ktls_refused.add((host, port))
+                    transport = _SslSocketTransport(loop, sock, protocol)
+                else:
+                    transport, _ = await loop.create_connection(lambda: protocol, sock=sock)
+            else:
+                protocol = ArrowStreamProtocol(wrapper, reader, request)
+                transport, _ = await loop.create_connection(
+                    lambda: protocol, host, port, ssl=context)
+            status, headers = await protocol.head
+            if status in _REDIRECT_STATUSES and "location" in headers:
+                transport.close()
+                url = urljoin(url, headers["location"])
+                continue
+            if not 200 <= status < 300:
+                transport.close()
+                raise RuntimeError(f"HTTP {status} fetching {url}")
+            await protocol.done
+            return
+        raise RuntimeError(f"too many redirects fetching {url}")
+    except Exception as e:
+        reader._error = e
+        reader.mark_done()
+        raise
@@ -0,0 +1,313 @@
+import asyncio
+import collections
+import ssl
+import weakref
+from typing import Deque, Dict, Optional, Tuple
+from urllib.parse import urlsplit
+
+import h2.config
+import h2.connection
+import h2.errors
+import h2.events
+import h2.exceptions
+import h2.settings
+
+from .prototype_cpp import StreamDecoderWrapper
+
+# Receive window of each stream, which is also the number of queued batch bytes above which
+# a stream's window stops being reopened
+_STREAM_WINDOW = 1 << 20
+# Receive window shared by all streams of a connection; kept at the maximum so that only the
+# per-stream windows limit the server
+_CONNECTION_WINDOW = (1 << 31) - 1
+_READ_SIZE = 64 * 1024
+
+
+class _Stream:
+    """State of one request multiplexed over an Http2Connection."""
+
+    def __init__(self, url: str, stream_id: int, wrapper: StreamDecoderWrapper, reader):
+        self.url = url
+        self.stream_id = stream_id
+        self.wrapper = wrapper
+        self.reader = reader
+        self.done = asyncio.get_running_loop().create_future()
+        self.unacked = 0                        # received bytes whose window is not reopened yet
+
+
+class Http2Connection:
+    """Client HTTP/2 connection that multiplexes many stream requests.
+
+    Every response body is fed to its own decoder as DATA frames arrive. A stream's receive
+    window is only reopened while its reader holds less than ``window`` bytes of queued
+    batches, so the server stops sending to a slow consumer without stalling the other streams
+    on the connection: the connection-level window is kept fully open.
+
+    https connections negotiate ``h2`` with ALPN, using ``ssl_context`` (whose ALPN protocols
+    are set to ``h2``) or a default context; plain http uses HTTP/2 with prior knowledge.
+    """
+
+    def __init__(self, scheme: str, host: str, port: int,
+                 ssl_context: Optional[ssl.SSLContext] = None, window: int = _STREAM_WINDOW):
+        self.users = 0                          # requests using or waiting for this connection
+        self._scheme = scheme
+        self._host = host
+        self._port = port
+        self._ssl_context = ssl_context
+        self._window = window
+        self._reader: Optional[asyncio.StreamReader] = None
+        self._writer: Optional[asyncio.StreamWriter] = None
+        self._read_task: Optional[asyncio.Task] = None
+        self._streams: Dict[int, _Stream] = {}
+        self._slot_waiters: Deque[asyncio.Future] = collections.deque()
+        self._error: Optional[Exception] = None  # set once the connection is unusable
+        # Resolved by the server's first SETTINGS frame, which carries its stream limit
+        self._settings_received = asyncio.get_running_loop().create_future()
+
+        self._conn = h2.connection.H2Connection(
+            h2.config.H2Configuration(client_side=True, header_encoding="utf-8"))
+        self._conn.local_settings = h2.settings.Settings(client=True, initial_values={
+            h2.settings.SettingCodes.INITIAL_WINDOW_SIZE: window,
+            h2.settings.SettingCodes.ENABLE_PUSH: 0,
+        })
+        self._opened = asyncio.ensure_future(self._open())
+
+    @property
+    def closed(self) -> bool:
+        return self._error is not None
+
+    async def _open(self):
+        ssl_context = None
+        if self._scheme == "https":
+            ssl_context = self._ssl_context or ssl.create_default_context()
+            ssl_context.set_alpn_protocols(["h2"])
+        try:
+            self._reader, self._writer = await asyncio.open_connection(
+                self._host, self._port, ssl=ssl_context)
+            if ssl_context is not None:
+                protocol = self._writer.get_extra_info("ssl_object").selected_alpn_protocol()
+                if protocol != "h2":
+                    raise ConnectionError(f"{self._host}:{self._port} does not support HTTP/2")
+            self._conn.initiate_connection()
+            self._conn.increment_flow_control_window(
+                _CONNECTION_WINDOW - self._conn.inbound_flow_control_window)
+            self._flush()
+            self._read_task = asyncio.ensure_future(self._read_loop())
+            await self._settings_received
+        except Exception as e:
+            self._close(e)
+            raise
+
+    async def fetch(self, url: str, wrapper: StreamDecoderWrapper, reader):
+        """Request url on this connection and feed the response body to wrapper.
+
+        Returns once the whole body has been consumed; wrapper.finish() is left to the caller.
+        The stream's window is not reopened while wrapper.queue_full() holds.
+
+        Parameters
+        ----------
+            url: http(s) URL on this connection's host
+            wrapper: StreamDecoderWrapper or TextStreamReader instance to consume bytes
+            reader: AsyncRecordBatchReader receiving the decoded batches
+
+        Raises
+        ------
+            RuntimeError: if the response status is not 2xx
+            ConnectionError: if the stream is reset or the connection fails
+        """
+        await self._opened
+        # Respect the server's SETTINGS_MAX_CONCURRENT_STREAMS; later requests queue here
+        while not self.closed and \
+                self._conn.open_outbound_streams >= self._conn.remote_settings.max_concurrent_streams:
+            waiter = asyncio.get_running_loop().create_future()
+            self._slot_waiters.append(waiter)
+            await waiter
+        if self._error is not None:
+            raise self._error
+
+        parts = urlsplit(url)
+        stream_id = self._conn.get_next_available_stream_id()
+        self._conn.send_headers(stream_id, [
+            (":method", "GET"),
+            (":scheme", self._scheme),
+            (":authority", parts.netloc),
+            (":path", (parts.path or "/") + (f"?{parts.query}" if parts.query else "")),
+            ("accept", "application/vnd.apache.arrow.stream, */*"),
+        ], end_stream=True)
+        stream = self._streams[stream_id] = _Stream(url, stream_id, wrapper, reader)
+        reader._on_dequeue = lambda: self._release(stream)
+        loop = asyncio.get_running_loop()
+        wrapper.set_drain_callback(lambda: loop.call_soon_threadsafe(self._release, stream))
+        self._flush()
+        try:
+            await stream.done
+        finally:
+            reader._on_dequeue = None
+
+    def close(self):
+        """Send GOAWAY and close the connection, failing any stream still open."""
+        if self.closed:
+            return
+        if self._writer is not None:
+            self._conn.close_connection()
+            self._flush()
+        self._close(ConnectionError("connection closed"))
+
+    async def _read_loop(self):
+        try:
+            while True:
+                data = await self._reader.read(_READ_SIZE)
+                if not data:
+                    raise ConnectionError("connection closed by server")
+                for event in self._conn.receive_data(data):
+                    self._handle(event)
+                self._flush()
+        except asyncio.CancelledError:
+            pass
+        except Exception as e:
+            self._close(e)
+
+    def _handle(self, event: h2.events.Event):
+        if isinstance(event, h2.events.ConnectionTerminated):
+            raise ConnectionError(f"connection terminated by server: {event.error_code!r}")
+        if isinstance(event, h2.events.RemoteSettingsChanged):
+            if not self._settings_received.done():
+                self._settings_received.set_result(None)
+            self._wake_slot_waiters()
+            return
+        stream = self._streams.get(getattr(event, "stream_id", None))
+        if isinstance(event, h2.events.DataReceived):
+            if stream is None:
+                # Late data for a failed stream still counts against the connection window
+                self._conn.acknowledge_received_data(event.flow_controlled_length, event.stream_id)
+                return
+            stream.unacked += event.flow_controlled_length
+            try:
+                stream.wrapper.consume_bytes(bytearray(event.data))
+            except Exception as e:
+                self._fail(stream, e)
+                return
+            self._release(stream)
+        elif stream is None:
+            return
+        elif isinstance(event, h2.events.ResponseReceived):
+            headers = dict(event.headers)
+            status = int(headers[":status"])
+            if not 200 <= status < 300:
+                self._fail(stream, RuntimeError(f"HTTP {status} fetching {stream.url}"))
+            elif headers.get("content-encoding", "identity") != "identity":
+                self._fail(stream, ValueError(
+                    f"unsupported content-encoding: {headers['content-encoding']}"))
+        elif isinstance(event, h2.events.StreamEnded):
+            self._remove(stream)
+            stream.done.set_result(None)
+        elif isinstance(event, h2.events.StreamReset):
+            self._remove(stream)
+            stream.done.set_exception(ConnectionError(
+                f"stream reset by server: {event.error_code!r}"))
+
+    def _release(self, stream: _Stream):
+        """Reopen the stream's window for what it received, unless its reader or parser is backed up."""
+        if not stream.unacked or self.closed or stream.stream_id not in self._streams:
+            return
+        if stream.reader._queued_bytes >= self._window or stream.wrapper.queue_full():
+            return
+        self._conn.acknowledge_received_data(stream.unacked, stream.stream_id)
+        stream.unacked = 0
+        self._flush()
+
+    def _fail(self, stream: _Stream, exc: Exception):
+        self._remove(stream)
+        try:
+            self._conn.reset_stream(stream.stream_id, h2.errors.ErrorCodes.CANCEL)
+        except h2.exceptions.StreamClosedError:
+            pass
+        if not stream.done.done():
+            stream.done.set_exception(exc)
+
+    def _remove(self, stream: _Stream):
+        if self._streams.pop(stream.stream_id, None) is not None:
+            self._wake_slot_waiters()
+
+    def _wake_slot_waiters(self):
+        # Woken requests re-check the limit themselves
+        while self._slot_waiters:
+            waiter = self._slot_waiters.popleft()
+            if not waiter.done():
+                waiter.set_result(None)
+
+    def _flush(self):
+        data = self._conn.data_to_send()
+        if data and not self._writer.is_closing():
+            self._writer.write(data)
+
+    def _close(self, exc: Exception):
+        if self._error is not None:
+            return
+        self._error = exc
+        if not self._settings_received.done():
+            self._settings_received.set_exception(exc)
+        for stream in list(self._streams.values()):
+            if not stream.done.done():
+                stream.done.set_exception(exc)
+        self._streams.clear()
+        self._wake_slot_waiters()
+        if self._read_task is not None and self._read_task is not asyncio.current_task():
+            self._read_task.cancel()
+        if self._writer is not None:
+            self._writer.close()
+
+
+# Open connections of each event loop by (scheme, host, port, ssl_context)
+_connections: "weakref.WeakKeyDictionary[asyncio.AbstractEventLoop, Dict[Tuple[str, str, int, Optional[ssl.SSLContext]], Http2Connection]]" = \
+    weakref.WeakKeyDictionary()
+
+
+async def read_stream_h2(url: str, wrapper: StreamDecoderWrapper, reader,
+                         ssl_context: Optional[ssl.SSLContext] = None):
+    """Background task to read the stream over a shared HTTP/2 connection
+
+    Concurrent calls for the same scheme, host, port and SSL context share one connection,
+    which is closed once its last request is done.
+
+    Parameters
+    ----------
+        url: http(s) URL to fetch Arrow IPC stream from
+        wrapper: StreamDecoderWrapper or TextStreamReader instance to consume bytes
+        reader: AsyncRecordBatchReader to receive batches
+        ssl_context: context for https; None uses the default certificate checks
+
+    Raises
+    ------
+        Exception: Any error during stream reading is caught and stored in reader
+    """
+    try:
+        parts = urlsplit(url)
+        if parts.scheme not in ("http", "https"):
+            raise ValueError(f"unsupported URL scheme for h2 transport: {parts.scheme!r}")
+        key = (parts.scheme, parts.hostname, parts.port or (443 if parts.scheme == "https" else 80),
+               ssl_context)
+        pool = _connections.setdefault(asyncio.get_running_loop(), {})
+        connection = pool.get(key)
+        if connection is None or connection.closed:
+            connection = pool[key] = Http2Connection(*key)
+        connection.users += 1
+        try:
+            await connection.fetch(url, wrapper, reader)
+        finally:
+            connection.users -= 1
+            if not connection.users:
+                connection.close()
+                if pool.get(key) is connection:
+                    del pool[key]
+        loop = asyncio.get_running_loop()
+        finished = loop.create_future()
+        wrapper.finish(lambda error: loop.call_soon_threadsafe(finished.set_result, error))
+        error = await finished
+        if error:
+            raise RuntimeError(error)
+        reader.mark_done()
+    except Exception as e:
+        reader._error = e
+        reader.mark_done()
+        raise
@@ -1,44 +1,647 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <utility>
 
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arrow/acero/exec_plan.h>
+#include <arrow/acero/options.h>
 #include <arrow/api.h>
 #include <arrow/c/bridge.h>
+#include <arrow/compute/api.h>
+#include <arrow/csv/api.h>
+#include <arrow/dataset/api.h>
+#include <arrow/dataset/plan.h>
+#include <arrow/filesystem/api.h>
+#include <arrow/io/file.h>
+#include <arrow/io/memory.h>
+#include <arrow/io/interfaces.h>
 #include <arrow/ipc/reader.h>
+#include <arrow/ipc/writer.h>
+#include <arrow/json/api.h>
+#include <arrow/util/async_generator.h>
+#include <arrow/util/bit_util.h>
+#include <arrow/util/byte_size.h>
+#include <arrow/util/checked_cast.h>
+#include <arrow/util/compression.h>
+#include <arrow/util/io_util.h>
+#include <arrow/util/thread_pool.h>
+#include <parquet/arrow/reader.h>
+#include <parquet/arrow/schema.h>
+#include <parquet/file_reader.h>
+#include <parquet/statistics.h>
+#ifdef PROTOTYPE_WITH_SUBSTRAIT
+#include <arrow/engine/substrait/api.h>
+#endif
 #include <nanobind/nanobind.h>
+#include <nanobind/ndarray.h>
 #include <nanobind/stl/function.h>
+#include <nanobind/stl/map.h>
+#include <nanobind/stl/shared_ptr.h>
 #include <nanobind/stl/string.h>
+#include <nanobind/stl/tuple.h>
+#include <nanobind/stl/vector.h>
 
 using namespace arrow;
+using arrow::internal::checked_cast;
 namespace nb = nanobind;
 
-// Wrapper for ArrowArrayStream with RAII cleanup
-// Ensures the stream is properly released when the handle goes out of scope.
-struct ArrayStreamHandle {
-  ArrowArrayStream stream{};
-  ~ArrayStreamHandle() {
-    if (stream.release) {
-      stream.release(&stream);
+// USDT probes for bpftrace and other uprobe-based tracers, under the provider "prototype".
+// Each probe site is a nop plus a test of its semaphore, which a tracer increments while it
+// is attached, so the arguments (sizes, timestamps) are only computed while someone listens.
+// Without <sys/sdt.h> at build time the probes compile to nothing. For example:
+//   bpftrace -e 'usdt:prototype/prototype_cpp*.so:prototype:batch_decoded { @rows = hist(arg1); }'
+#ifdef PROTOTYPE_WITH_USDT
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define PROTOTYPE_PROBE_SEMAPHORE(name)                                    \
+  extern "C" {                                                            \
+  __attribute__((unused, section(".probes"))) volatile unsigned short     \
+      prototype_##name##_semaphore;                                       \
+  }
+#define PROTOTYPE_PROBE(name, ...)                                         \
+  do {                                                                    \
+    if (__builtin_expect(prototype_##name##_semaphore, 0)) {              \
+      STAP_PROBEV(prototype, name, __VA_ARGS__);                          \
+    }                                                                     \
+  } while (0)
+#else
+#define PROTOTYPE_PROBE_SEMAPHORE(name)
+#define PROTOTYPE_PROBE(name, ...) \
+  do {                             \
+  } while (0)
+#endif
+
+// Probe arguments; times are CLOCK_MONOTONIC nanoseconds and stream ids come from
+// Listener::stream_id()
+// schema_decoded(stream_id, num_fields, time)
+PROTOTYPE_PROBE_SEMAPHORE(schema_decoded)
+// batch_decoded(stream_id, rows, bytes, time), before projection, filters and casts
+PROTOTYPE_PROBE_SEMAPHORE(batch_decoded)
+// batch_exported(stream_id, rows, bytes, time), before the batch callback runs
+PROTOTYPE_PROBE_SEMAPHORE(batch_exported)
+// bytes_consumed(stream_id, bytes, time), before the bytes are decoded
+PROTOTYPE_PROBE_SEMAPHORE(bytes_consumed)
+// queue_enqueue / queue_dequeue(stream_id, depth after the operation, bytes, time), for the
+// native queues: buffers waiting in a BufferFeeder and batches waiting in a BusyPollSource
+PROTOTYPE_PROBE_SEMAPHORE(queue_enqueue)
+PROTOTYPE_PROBE_SEMAPHORE(queue_dequeue)
+
+// CLOCK_MONOTONIC in nanoseconds, the clock behind Python's time.monotonic_ns()
+int64_t MonotonicNanos() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Wrapper for ArrowArray with RAII cleanup, for batches exported without their schema
+struct ArrayHandle {
+  ArrowArray array{};
+  ~ArrayHandle() {
+    if (array.release) {
+      array.release(&array);
+    }
+  }
+};
+
+// Process-wide registry of the schemas seen by any stream, keyed by schema fingerprint.
+// Streams with the same schema share one Schema object and one id, so Python exports and
+// imports each distinct schema once and batches cross the C interface without a schema.
+// Entries are never evicted; the registry grows with the number of distinct schemas.
+class SchemaCache {
+private:
+  std::mutex mutex_;
+  std::map<std::string, uint64_t> ids_;
+  // Schemas of types without a fingerprint (e.g. some extension types), compared by value
+  std::vector<uint64_t> unfingerprinted_;
+  std::vector<std::shared_ptr<Schema>> schemas_;
+
+public:
+  static SchemaCache& Instance() {
+    static SchemaCache cache;
+    return cache;
+  }
+
+  // @return The id of the interned schema equal to `schema` (including metadata)
+  uint64_t Intern(const std::shared_ptr<Schema>& schema) {
+    const auto& fingerprint = schema->fingerprint();
+    auto key = fingerprint.empty() ? std::string() : fingerprint + schema->metadata_fingerprint();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (key.empty()) {
+      for (auto id : unfingerprinted_) {
+        if (schemas_[id]->Equals(*schema, /*check_metadata=*/true)) {
+          return id;
+        }
+      }
+      unfingerprinted_.push_back(schemas_.size());
+    } else {
+      auto [it, inserted] = ids_.emplace(std::move(key), schemas_.size());
+      if (!inserted) {
+        return it->second;
+      }
     }
+    schemas_.push_back(schema);
+    return schemas_.size() - 1;
+  }
+
+  // @throws std::out_of_range if no schema has the id
+  std::shared_ptr<Schema> Get(uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return schemas_.at(id);
   }
 };
 
 // Simple function to illustrate usage of nanobind
 int get_arrow_version() { return ARROW_VERSION_MAJOR; }
 
+// Whether the module was built with Arrow Substrait, which expression arguments need
+bool has_substrait() {
+#ifdef PROTOTYPE_WITH_SUBSTRAIT
+  return true;
+#else
+  return false;
+#endif
+}
+
+// In-process consumer of decoded data, such as an Acero source node.
+// A Listener with a sink hands batches to it instead of to the Python batch callback.
+class BatchSink {
+public:
+  virtual ~BatchSink() = default;
+  virtual Status OnSchema(const std::shared_ptr<Schema>& schema) = 0;
+  virtual Status OnBatch(const std::shared_ptr<RecordBatch>& batch) = 0;
+  // Called at the end of input, with the error if the stream failed
+  virtual void OnFinish(const Status& status) = 0;
+};
+
+// Events counted by PerfCounters
+enum PerfEvent { kCycles, kInstructions, kCacheMisses, kBranchMisses, kPageFaults, kPerfEventCount };
+
+constexpr const char* kPerfEventNames[kPerfEventCount] = {
+    "cycles", "instructions", "cache_misses", "branch_misses", "page_faults"};
+
+using PerfValues = std::array<uint64_t, kPerfEventCount>;
+
+// perf_event counters of the calling thread, user space only. The events are opened as one
+// group, so a single read() returns all of them; events the CPU or kernel do not provide
+// (e.g. hardware events in many VMs, or with a strict perf_event_paranoid) are left out.
+class PerfCounters {
+private:
+  int leader_ = -1;
+  std::vector<int> fds_;
+  // Position of each event in the group's read() output, or -1 if it could not be opened
+  std::array<int, kPerfEventCount> slots_;
+  // errno of the last event that failed to open
+  int error_ = 0;
+
+public:
+  PerfCounters() {
+    slots_.fill(-1);
+    const std::pair<uint32_t, uint64_t> events[kPerfEventCount] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    };
+    for (int i = 0; i < kPerfEventCount; i++) {
+      perf_event_attr attr{};
+      attr.size = sizeof(attr);
+      attr.type = events[i].first;
+      attr.config = events[i].second;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                         PERF_FORMAT_TOTAL_TIME_RUNNING;
+      auto fd = static_cast<int>(
+          syscall(SYS_perf_event_open, &attr, 0, -1, leader_, PERF_FLAG_FD_CLOEXEC));
+      if (fd < 0) {
+        error_ = errno;
+        continue;
+      }
+      if (leader_ < 0) {
+        leader_ = fd;
+      }
+      slots_[i] = static_cast<int>(fds_.size());
+      fds_.push_back(fd);
+    }
+  }
+
+  ~PerfCounters() {
+    for (auto fd : fds_) {
+      close(fd);
+    }
+  }
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  // Counters of the calling thread, opened on its first use
+  static PerfCounters& ForThisThread() {
+    thread_local PerfCounters counters;
+    return counters;
+  }
+
+  bool Counts(int event) const { return slots_[event] >= 0; }
+
+  // @return OK if at least one event is counted, otherwise why the last one failed to open
+  Status CheckAvailable() const {
+    if (leader_ >= 0) {
+      return Status::OK();
+    }
+    return arrow::internal::IOErrorFromErrno(error_, "perf_event_open failed");
+  }
+
+  // Counts since the counters were opened, scaled up if the kernel multiplexed the group
+  // with other events. Events that are not counted read as 0.
+  PerfValues Read() const {
+    PerfValues values{};
+    // Number of events, time enabled, time running, then one value per event
+    uint64_t data[3 + kPerfEventCount];
+    if (leader_ < 0 || read(leader_, data, sizeof(data)) <= 0 || data[2] == 0) {
+      return values;
+    }
+    auto scale = static_cast<double>(data[1]) / static_cast<double>(data[2]);
+    for (int i = 0; i < kPerfEventCount; i++) {
+      if (slots_[i] >= 0) {
+        values[i] = static_cast<uint64_t>(static_cast<double>(data[3 + slots_[i]]) * scale);
+      }
+    }
+    return values;
+  }
+};
+
+// Counter totals over every call to one measured region, with the units of work (bytes or
+// batches) the calls processed. Calls may come from several threads.
+class PerfRegion {
+private:
+  std::atomic<uint64_t> calls_{0};
+  std::atomic<uint64_t> units_{0};
+  std::array<std::atomic<uint64_t>, kPerfEventCount> totals_{};
+
+public:
+  void Add(const PerfValues& before, const PerfValues& after, uint64_t units) {
+    calls_.fetch_add(1, std::memory_order_relaxed);
+    units_.fetch_add(units, std::memory_order_relaxed);
+    for (int i = 0; i < kPerfEventCount; i++) {
+      // Scaling for multiplexing can make a count step back slightly
+      if (after[i] > before[i]) {
+        totals_[i].fetch_add(after[i] - before[i], std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // @param unit Name the units are reported under, e.g. "bytes"
+  // @param counted Which events the counters provide; the others are left out
+  std::map<std::string, uint64_t> Totals(const std::string& unit,
+                                         const PerfCounters& counted) const {
+    std::map<std::string, uint64_t> totals{{"calls", calls_.load()}, {unit, units_.load()}};
+    for (int i = 0; i < kPerfEventCount; i++) {
+      if (counted.Counts(i)) {
+        totals[kPerfEventNames[i]] = totals_[i].load();
+      }
+    }
+    return totals;
+  }
+};
+
+// Adds the calling thread's counter deltas over the scope's lifetime to a region. Without a
+// region it does nothing, so measuring costs one branch while counters are disabled.
+class PerfScope {
+private:
+  PerfRegion* region_;
+  uint64_t units_;
+  PerfValues before_;
+
+public:
+  PerfScope(PerfRegion* region, uint64_t units) : region_(region), units_(units) {
+    if (region_) {
+      before_ = PerfCounters::ForThisThread().Read();
+    }
+  }
+
+  ~PerfScope() {
+    if (region_) {
+      region_->Add(before_, PerfCounters::ForThisThread().Read(), units_);
+    }
+  }
+};
+
+// Regions measured by a StreamDecoderWrapper with counters enabled. Consuming input includes
+// exporting the batches it completes, so `consume` counts are a superset of `exported`.
+struct DecoderPerfStats {
+  // Decoder input, per chunk of bytes consumed
+  PerfRegion consume;
+  // Export of each decoded batch to the C Data Interface and its batch callback
+  PerfRegion exported;
+};
+
+// A `column op value` comparison, where op is one of ==, !=, <, <=, >, >=
+struct ColumnPredicate {
+  std::string column;
+  std::string op;
+  std::shared_ptr<Scalar> value;
+};
+
+// Name of the compute function implementing a comparison op, or nullptr if it is unknown
+const char* CompareFunction(const std::string& op) {
+  if (op == "==") return "equal";
+  if (op == "!=") return "not_equal";
+  if (op == "<") return "less";
+  if (op == "<=") return "less_equal";
+  if (op == ">") return "greater";
+  if (op == ">=") return "greater_equal";
+  return nullptr;
+}
+
+// Build predicates from parallel lists, as passed from Python
+// @param columns Column names, one per predicate
+// @param ops Comparison operators: ==, !=, <, <=, >, >=
+// @param values One-row batch whose i-th column holds the i-th predicate's value
+// @throws std::invalid_argument if the arguments do not line up or an op is unknown
+std::vector<ColumnPredicate> MakePredicates(const std::vector<std::string>& columns,
+                                            const std::vector<std::string>& ops,
+                                            const std::shared_ptr<RecordBatch>& values) {
+  if (columns.size() != ops.size() ||
+      static_cast<int>(columns.size()) != values->num_columns() || values->num_rows() != 1) {
+    throw std::invalid_argument("Filter columns, ops and values do not line up");
+  }
+  std::vector<ColumnPredicate> predicates;
+  for (size_t i = 0; i < columns.size(); i++) {
+    if (!CompareFunction(ops[i])) {
+      throw std::invalid_argument("Unknown filter op: " + ops[i]);
+    }
+    auto value = values->column(static_cast<int>(i))->GetScalar(0);
+    if (!value.ok()) {
+      throw std::runtime_error(value.status().ToString());
+    }
+    predicates.push_back({columns[i], ops[i], std::move(value).ValueUnsafe()});
+  }
+  return predicates;
+}
+
+// Drops the rows of a batch that fail any of a conjunction of predicates.
+// A predicate on a dictionary column is evaluated once per dictionary entry and the
+// per-entry results are gathered over the indices, so the comparison never runs on expanded
+// values. The per-entry results are kept until the column's dictionary changes: batches
+// decoded against the same IPC dictionary share one dictionary array, so they only pay for
+// the gather.
+class RowFilter {
+private:
+  std::vector<ColumnPredicate> predicates_;
+  // Per predicate: the dictionary last evaluated and its per-entry results
+  std::vector<std::pair<std::shared_ptr<ArrayData>, Datum>> dictionary_matches_;
+
+public:
+  explicit RowFilter(std::vector<ColumnPredicate> predicates)
+      : predicates_(std::move(predicates)), dictionary_matches_(predicates_.size()) {}
+
+  // @return The matching rows, or the batch itself if every row matches
+  Result<std::shared_ptr<RecordBatch>> Apply(const std::shared_ptr<RecordBatch>& batch) {
+    Datum mask;
+    for (size_t i = 0; i < predicates_.size(); i++) {
+      auto column = batch->GetColumnByName(predicates_[i].column);
+      if (!column) {
+        return Status::KeyError("Filter column not found: ", predicates_[i].column);
+      }
+      ARROW_ASSIGN_OR_RAISE(auto matches, Evaluate(i, *column));
+      if (mask.is_value()) {
+        ARROW_ASSIGN_OR_RAISE(mask, arrow::compute::CallFunction("and_kleene", {mask, matches}));
+      } else {
+        mask = std::move(matches);
+      }
+    }
+    if (!mask.is_value()) {
+      return batch;
+    }
+    auto selected = mask.make_array();
+    if (checked_cast<const BooleanArray&>(*selected).true_count() == batch->num_rows()) {
+      return batch;
+    }
+    ARROW_ASSIGN_OR_RAISE(auto filtered, arrow::compute::Filter(batch, selected));
+    return filtered.record_batch();
+  }
+
+private:
+  Result<Datum> Evaluate(size_t i, const Array& column) {
+    const auto& predicate = predicates_[i];
+    auto function = CompareFunction(predicate.op);
+    if (column.type_id() != Type::DICTIONARY) {
+      return arrow::compute::CallFunction(function, {column, predicate.value});
+    }
+    const auto& dictionary_array = checked_cast<const DictionaryArray&>(column);
+    auto& [dictionary, matches] = dictionary_matches_[i];
+    if (dictionary != column.data()->dictionary) {
+      dictionary = column.data()->dictionary;
+      ARROW_ASSIGN_OR_RAISE(matches, arrow::compute::CallFunction(
+                                         function, {dictionary_array.dictionary(), predicate.value}));
+    }
+    return arrow::compute::Take(matches, dictionary_array.indices());
+  }
+};
+
+// Nested field paths to keep, e.g. {"a", "b", "c"} for field c of struct b of column a.
+// A path component following a list column names a field of the list's struct values.
+using FieldPaths = std::vector<std::vector<std::string>>;
+
+// Requested children of a nested field; empty means the whole field
+struct ProjectionNode {
+  std::map<std::string, ProjectionNode> children;
+  bool whole = false;
+};
+
+ProjectionNode MakeProjectionTree(const FieldPaths& paths) {
+  ProjectionNode root;
+  for (const auto& path : paths) {
+    auto* node = &root;
+    for (const auto& name : path) {
+      node = &node->children[name];
+    }
+    node->whole = true;
+  }
+  return root;
+}
+
+bool IsList(const DataType& type) {
+  return type.id() == Type::LIST || type.id() == Type::LARGE_LIST;
+}
+
+// Keep only the requested children of a struct (or list of structs) array. Buffers are shared
+// with the input; only the array metadata is rebuilt.
+Result<std::shared_ptr<ArrayData>> PruneArray(const std::shared_ptr<ArrayData>& data,
+                                              const ProjectionNode& node, const std::string& name) {
+  if (node.whole || node.children.empty()) {
+    return data;
+  }
+  auto pruned = data->Copy();
+  if (IsList(*data->type)) {
+    const auto& value_field = checked_cast<const BaseListType&>(*data->type).value_field();
+    ARROW_ASSIGN_OR_RAISE(pruned->child_data[0], PruneArray(data->child_data[0], node, name));
+    auto values = value_field->WithType(pruned->child_data[0]->type);
+    pruned->type = data->type->id() == Type::LIST ? arrow::list(values) : arrow::large_list(values);
+    return pruned;
+  }
+  if (data->type->id() != Type::STRUCT) {
+    return Status::Invalid("Cannot select children of '", name, "' of type ", *data->type);
+  }
+  FieldVector fields;
+  pruned->child_data.clear();
+  for (int i = 0; i < data->type->num_fields(); i++) {
+    const auto& field = data->type->field(i);
+    auto it = node.children.find(field->name());
+    if (it == node.children.end()) {
+      continue;
+    }
+    ARROW_ASSIGN_OR_RAISE(auto child, PruneArray(data->child_data[i], it->second,
+                                                 name + "." + field->name()));
+    fields.push_back(field->WithType(child->type));
+    pruned->child_data.push_back(std::move(child));
+  }
+  if (fields.size() != node.children.size()) {
+    return Status::KeyError("A requested child of '", name, "' does not exist");
+  }
+  pruned->type = arrow::struct_(std::move(fields));
+  return pruned;
+}
+
+// Follow `path` from `array`, merging struct validity into the result. Steps through a
+// list produce a list of the selected values.
+Result<std::shared_ptr<Array>> FlattenPath(const std::shared_ptr<Array>& array,
+                                           const std::vector<std::string>& path, size_t depth) {
+  if (depth == path.size()) {
+    return array;
+  }
+  if (IsList(*array->type())) {
+    auto data = array->data()->Copy();
+    ARROW_ASSIGN_OR_RAISE(auto values, FlattenPath(arrow::MakeArray(data->child_data[0]), path, depth));
+    const auto& value_field = checked_cast<const BaseListType&>(*data->type).value_field();
+    auto field = value_field->WithType(values->type());
+    data->type = data->type->id() == Type::LIST ? arrow::list(field) : arrow::large_list(field);
+    data->child_data[0] = values->data();
+    return arrow::MakeArray(std::move(data));
+  }
+  if (array->type_id() != Type::STRUCT) {
+    return Status::Invalid("Cannot select '", path[depth], "' from a field of type ", *array->type());
+  }
+  const auto& structs = checked_cast<const StructArray&>(*array);
+  auto index = structs.struct_type()->GetFieldIndex(path[depth]);
+  if (index < 0) {
+    return Status::KeyError("No field '", path[depth], "' in ", *array->type());
+  }
+  ARROW_ASSIGN_OR_RAISE(auto child, structs.GetFlattenedField(index));
+  return FlattenPath(child, path, depth + 1);
+}
+
+// Apply a projection to a batch: either prune nested columns to the requested children, or
+// return one top-level column per path, named by the dotted path
+Result<std::shared_ptr<RecordBatch>> ProjectBatch(const RecordBatch& batch, const FieldPaths& paths,
+                                                  bool flatten) {
+  FieldVector fields;
+  ArrayVector columns;
+  if (flatten) {
+    for (const auto& path : paths) {
+      auto index = batch.schema()->GetFieldIndex(path[0]);
+      if (index < 0) {
+        return Status::KeyError("No column '", path[0], "' in the stream");
+      }
+      ARROW_ASSIGN_OR_RAISE(auto column, FlattenPath(batch.column(index), path, 1));
+      std::string name = path[0];
+      for (size_t i = 1; i < path.size(); i++) {
+        name += "." + path[i];
+      }
+      fields.push_back(arrow::field(name, column->type()));
+      columns.push_back(std::move(column));
+    }
+  } else {
+    auto tree = MakeProjectionTree(paths);
+    for (int i = 0; i < batch.num_columns(); i++) {
+      const auto& field = batch.schema()->field(i);
+      auto it = tree.children.find(field->name());
+      if (it == tree.children.end()) {
+        continue;
+      }
+      ARROW_ASSIGN_OR_RAISE(auto data, PruneArray(batch.column_data(i), it->second, field->name()));
+      fields.push_back(field->WithType(data->type));
+      columns.push_back(arrow::MakeArray(std::move(data)));
+    }
+    if (fields.size() != tree.children.size()) {
+      return Status::KeyError("A projected column is not in the stream");
+    }
+  }
+  return RecordBatch::Make(arrow::schema(std::move(fields), batch.schema()->metadata()),
+                           batch.num_rows(), std::move(columns));
+}
+
 // Custom Listener class that handles decoded Arrow RecordBatches.
 // Converts each batch to a C Data Interface format and passes it to a Python callback.
 class Listener : public arrow::ipc::Listener {
 private:
-  std::function<void(uintptr_t)> batch_callback_;
-  std::function<void(uintptr_t)> schema_callback_;
+  std::function<void(uintptr_t, uint64_t)> batch_callback_;
+  std::function<void(uint64_t)> schema_callback_;
+  // Batch schema last interned, to skip the lookup while the schema stays the same
+  std::shared_ptr<Schema> batch_schema_;
+  uint64_t batch_schema_id_ = 0;
+  std::shared_ptr<BatchSink> sink_;
+  FieldPaths projection_;
+  bool flatten_ = false;
+  std::unique_ptr<RowFilter> filter_;
+  std::shared_ptr<Schema> cast_to_;
+  arrow::compute::CastOptions cast_options_;
+  std::shared_ptr<DecoderPerfStats> perf_;
+  // Process-wide unique id identifying the stream in probes
+  uint64_t stream_id_ = NextStreamId();
+
+  static uint64_t NextStreamId() {
+    static std::atomic<uint64_t> next{1};
+    return next.fetch_add(1, std::memory_order_relaxed);
+  }
 
 public:
+  uint64_t stream_id() const { return stream_id_; }
+
+  // With a projection the decoder skips unprojected columns; only describe the decoded ones
+  Status OnSchemaDecoded(std::shared_ptr<Schema> schema,
+                         std::shared_ptr<Schema> filtered_schema) override {
+    return OnSchemaDecoded(std::move(filtered_schema));
+  }
+
   Status OnSchemaDecoded(std::shared_ptr<Schema> schema) override {
+    PROTOTYPE_PROBE(schema_decoded, stream_id_, schema->num_fields(), MonotonicNanos());
+    if (!projection_.empty()) {
+      ARROW_ASSIGN_OR_RAISE(auto empty, RecordBatch::MakeEmpty(schema));
+      ARROW_ASSIGN_OR_RAISE(auto projected, ProjectBatch(*empty, projection_, flatten_));
+      schema = projected->schema();
+    }
+    if (cast_to_) {
+      ARROW_ASSIGN_OR_RAISE(schema, CastSchema(*schema));
+    }
+    if (sink_) {
+      ARROW_RETURN_NOT_OK(sink_->OnSchema(schema));
+    }
+    // The schema is still reported to Python, which may need it to build a plan
     if (schema_callback_) {
-      struct ArrowSchema c_schema;
-      ARROW_RETURN_NOT_OK(arrow::ExportSchema(*schema, &c_schema));
-
-      schema_callback_(reinterpret_cast<uintptr_t>(&c_schema));
+      schema_callback_(SchemaCache::Instance().Intern(schema));
     }
     return Status::OK();
   }
@@ -46,38 +649,390 @@ public:
     if (!batch) {
       return Status::Invalid("Received null RecordBatch");
     }
+    PROTOTYPE_PROBE(batch_decoded, stream_id_, batch->num_rows(),
+                    arrow::util::TotalBufferSize(*batch), MonotonicNanos());
+    if (!projection_.empty()) {
+      ARROW_ASSIGN_OR_RAISE(batch, ProjectBatch(*batch, projection_, flatten_));
+    }
+    if (filter_) {
+      ARROW_ASSIGN_OR_RAISE(batch, filter_->Apply(batch));
+      if (batch->num_rows() == 0) {
+        return Status::OK();
+      }
+    }
+    if (cast_to_) {
+      ARROW_ASSIGN_OR_RAISE(batch, Cast(*batch));
+    }
+    if (sink_) {
+      return sink_->OnBatch(batch);
+    }
 
-    ArrayStreamHandle stream;
-    auto schema = batch->schema();
+    // Projection and casts build a new Schema per batch; equal ones map to the same id
+    if (batch->schema() != batch_schema_ &&
+        !(batch_schema_ && batch->schema()->Equals(*batch_schema_, /*check_metadata=*/true))) {
+      batch_schema_id_ = SchemaCache::Instance().Intern(batch->schema());
+    }
+    batch_schema_ = batch->schema();
 
-    ARROW_ASSIGN_OR_RAISE(auto reader,
-                         arrow::RecordBatchReader::Make({batch}, schema));
-    ARROW_RETURN_NOT_OK(arrow::ExportRecordBatchReader(reader, &stream.stream));
+    PerfScope scope(perf_ ? &perf_->exported : nullptr, 1);
+    ArrayHandle array;
+    ARROW_RETURN_NOT_OK(arrow::ExportRecordBatch(*batch, &array.array));
+    PROTOTYPE_PROBE(batch_exported, stream_id_, batch->num_rows(),
+                    arrow::util::TotalBufferSize(*batch), MonotonicNanos());
 
-    batch_callback_(reinterpret_cast<uintptr_t>(&stream.stream));
+    batch_callback_(reinterpret_cast<uintptr_t>(&array.array), batch_schema_id_);
 
     return Status::OK();
   }
 
-  void SetSchemaCallback(std::function<void(uintptr_t)> callback) {
+  // Signal the end of input to the sink, if any
+  void Finish(const Status& status) {
+    if (sink_) {
+      sink_->OnFinish(status);
+    }
+  }
+
+  void SetSink(std::shared_ptr<BatchSink> sink) {
+    this->sink_ = std::move(sink);
+  }
+
+  // Count hardware events around the export of each batch into `perf->exported`
+  void SetPerfStats(std::shared_ptr<DecoderPerfStats> perf) {
+    this->perf_ = std::move(perf);
+  }
+
+  // Keep only the given (possibly nested) fields of decoded batches; applied before any cast
+  // @param flatten Emit one column per path instead of pruned top-level columns
+  void SetProjection(FieldPaths paths, bool flatten) {
+    this->projection_ = std::move(paths);
+    this->flatten_ = flatten;
+  }
+
+  // Drop rows that fail any of the predicates; applied after the projection and before any
+  // cast, so predicates see the decoded types. Batches left without rows are not delivered.
+  void SetFilter(std::vector<ColumnPredicate> predicates) {
+    this->filter_ = std::make_unique<RowFilter>(std::move(predicates));
+  }
+
+  // Cast decoded batches before they are delivered. Fields of `cast_to` are matched to the
+  // stream's fields by name; fields it does not mention keep their type.
+  // @param safe Whether to fail on overflow, truncation and other lossy conversions
+  void SetCast(std::shared_ptr<Schema> cast_to, bool safe) {
+    this->cast_to_ = std::move(cast_to);
+    this->cast_options_ = safe ? arrow::compute::CastOptions::Safe()
+                               : arrow::compute::CastOptions::Unsafe();
+  }
+
+  // @param callback Called with the id of the decoded schema in the SchemaCache
+  void SetSchemaCallback(std::function<void(uint64_t)> callback) {
     this->schema_callback_ = callback;
   }
 
-  void SetBatchCallback(std::function<void(uintptr_t)> callback) {
+  // @param callback Called with a pointer to an ArrowArray holding the batch's columns and
+  // the SchemaCache id of its schema
+  void SetBatchCallback(std::function<void(uintptr_t, uint64_t)> callback) {
     this->batch_callback_ = callback;
   }
+
+private:
+  Result<std::shared_ptr<Schema>> CastSchema(const Schema& schema) const {
+    auto fields = schema.fields();
+    for (const auto& target : cast_to_->fields()) {
+      auto i = schema.GetFieldIndex(target->name());
+      if (i < 0) {
+        return Status::KeyError("Cast target field '", target->name(), "' is not in the stream");
+      }
+      fields[i] = fields[i]->WithType(target->type());
+    }
+    return arrow::schema(std::move(fields), schema.metadata());
+  }
+
+  // Cast the columns whose type differs from the target; the others are passed through
+  Result<std::shared_ptr<RecordBatch>> Cast(const RecordBatch& batch) const {
+    ARROW_ASSIGN_OR_RAISE(auto schema, CastSchema(*batch.schema()));
+    auto columns = batch.columns();
+    for (int i = 0; i < batch.num_columns(); i++) {
+      const auto& type = schema->field(i)->type();
+      if (!columns[i]->type()->Equals(*type)) {
+        ARROW_ASSIGN_OR_RAISE(columns[i], arrow::compute::Cast(*columns[i], type, cast_options_));
+      }
+    }
+    return RecordBatch::Make(std::move(schema), batch.num_rows(), std::move(columns));
+  }
+};
+
+// Open a filesystem URI (file://, s3://, gs://, ... or a local path) for sequential reading
+Result<std::shared_ptr<arrow::io::InputStream>> OpenUri(const std::string& uri) {
+  std::string path;
+  ARROW_ASSIGN_OR_RAISE(auto filesystem, arrow::fs::FileSystemFromUriOrPath(uri, &path));
+  return filesystem->OpenInputStream(path);
+}
+
+// Generator of `block_size` blocks read from `stream`. Blocking reads run on the I/O pool and
+// are queued up to `readahead` deep; consumers are transferred to the CPU pool so the I/O
+// threads only ever read.
+Result<AsyncGenerator<std::shared_ptr<Buffer>>> ReadAheadBlocks(
+    std::shared_ptr<arrow::io::InputStream> stream, int64_t block_size, int readahead) {
+  ARROW_ASSIGN_OR_RAISE(auto blocks, arrow::io::MakeInputStreamIterator(std::move(stream), block_size));
+  auto* executor = arrow::io::default_io_context().executor();
+  ARROW_ASSIGN_OR_RAISE(
+      auto background,
+      arrow::MakeBackgroundGenerator(std::move(blocks), executor, readahead,
+                                     std::max(1, readahead / 2)));
+  return arrow::MakeTransferredGenerator(std::move(background), arrow::internal::GetCpuThreadPool());
+}
+
+// Collects the schema and batches decoded from a stream, e.g. so a scan can pull them in order
+class CollectingListener : public arrow::ipc::Listener {
+public:
+  std::shared_ptr<Schema> schema;
+  RecordBatchVector batches;
+
+  Status OnSchemaDecoded(std::shared_ptr<Schema> decoded) override {
+    schema = std::move(decoded);
+    return Status::OK();
+  }
+
+  Status OnRecordBatchDecoded(std::shared_ptr<RecordBatch> batch) override {
+    batches.push_back(std::move(batch));
+    return Status::OK();
+  }
+};
+
+// StreamDecoder that decodes only the top-level columns named by a projection. Arrow only
+// knows the column indices once the schema message has been parsed, so until then the input
+// is parsed by a probe decoder and held back, then replayed into a decoder restricted to the
+// projected columns. Without a projection every column is decoded.
+class ProjectedDecoder {
+private:
+  std::shared_ptr<Listener> listener_;
+  std::unique_ptr<arrow::ipc::StreamDecoder> decoder_;
+  std::vector<std::string> columns_;
+  std::shared_ptr<CollectingListener> probe_listener_;
+  std::unique_ptr<arrow::ipc::StreamDecoder> probe_;
+  // Input received before the schema, replayed once the real decoder exists
+  std::vector<std::shared_ptr<Buffer>> held_;
+  bool started_ = false;
+
+public:
+  explicit ProjectedDecoder(std::shared_ptr<Listener> listener)
+      : listener_(std::move(listener)),
+        decoder_(std::make_unique<arrow::ipc::StreamDecoder>(listener_)) {}
+
+  // Restrict decoding to the given top-level columns. Must be called before any input.
+  Status SetColumns(std::vector<std::string> columns) {
+    if (started_) {
+      return Status::Invalid("The projection must be set before consuming any bytes");
+    }
+    columns_ = std::move(columns);
+    probe_listener_ = std::make_shared<CollectingListener>();
+    probe_ = std::make_unique<arrow::ipc::StreamDecoder>(probe_listener_);
+    return Status::OK();
+  }
+
+  Status Consume(const uint8_t* data, int64_t length) {
+    started_ = true;
+    if (!probe_) {
+      return decoder_->Consume(data, length);
+    }
+    // Held input must outlive the call, so it is copied until the schema is known
+    ARROW_ASSIGN_OR_RAISE(auto buffer, arrow::AllocateBuffer(length));
+    std::memcpy(buffer->mutable_data(), data, static_cast<size_t>(length));
+    return Consume(std::shared_ptr<Buffer>(std::move(buffer)));
+  }
+
+  Status Consume(std::shared_ptr<Buffer> buffer) {
+    started_ = true;
+    if (!probe_) {
+      return decoder_->Consume(std::move(buffer));
+    }
+    held_.push_back(buffer);
+    // Feed the probe only up to the end of the schema message, so no batch is decoded twice
+    int64_t offset = 0;
+    while (!probe_listener_->schema && offset < buffer->size()) {
+      if (probe_->next_required_size() == 0) {
+        // The probe has seen the end-of-stream marker, so no schema is coming
+        return Status::Invalid("Stream ended before its schema");
+      }
+      auto length = std::min(probe_->next_required_size(), buffer->size() - offset);
+      ARROW_RETURN_NOT_OK(probe_->Consume(arrow::SliceBuffer(buffer, offset, length)));
+      offset += length;
+    }
+    if (!probe_listener_->schema) {
+      return Status::OK();
+    }
+    const auto& schema = *probe_listener_->schema;
+    // An empty included_fields would decode every column
+    for (const auto& name : columns_) {
+      if (schema.GetAllFieldIndices(name).empty()) {
+        return Status::KeyError("No column '", name, "' in the stream");
+      }
+    }
+    auto options = arrow::ipc::IpcReadOptions::Defaults();
+    for (int i = 0; i < schema.num_fields(); i++) {
+      if (std::find(columns_.begin(), columns_.end(), schema.field(i)->name()) != columns_.end()) {
+        options.included_fields.push_back(i);
+      }
+    }
+    decoder_ = std::make_unique<arrow::ipc::StreamDecoder>(listener_, options);
+    probe_.reset();
+    probe_listener_.reset();
+    auto held = std::move(held_);
+    for (auto& block : held) {
+      ARROW_RETURN_NOT_OK(decoder_->Consume(std::move(block)));
+    }
+    return Status::OK();
+  }
+
+  int64_t next_required_size() const {
+    return probe_ ? probe_->next_required_size() : decoder_->next_required_size();
+  }
+};
+
+// Feeds owned buffers to a consumer on a dedicated thread, in order. Push() only queues, so
+// the caller (e.g. the event loop receiving WebSocket frames) never waits for decoding; once
+// `capacity` bytes are waiting it reports the queue full, and the caller should stop pulling
+// input until the drain callback runs.
+class BufferFeeder {
+private:
+  std::function<Status(std::shared_ptr<Buffer>)> consume_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::shared_ptr<Buffer>> queue_;
+  // Bytes pushed but not yet consumed, including the buffer being consumed
+  int64_t queued_bytes_ = 0;
+  int64_t capacity_;
+  // Whether Push() or Full() last reported a full queue, so the caller waits for a drain
+  bool full_reported_ = false;
+  std::function<void()> drain_callback_;
+  std::function<void(const std::string&)> done_callback_;
+  bool closed_ = false;
+  // Stream reported in queue probes
+  uint64_t stream_id_;
+  std::thread worker_;
+
+public:
+  // @param capacity Number of queued bytes at which the queue counts as full
+  // @param drain_callback Called on the feeder thread, without the lock, once a full queue
+  // drains below `capacity`
+  BufferFeeder(std::function<Status(std::shared_ptr<Buffer>)> consume, uint64_t stream_id,
+               int64_t capacity, std::function<void()> drain_callback)
+      : consume_(std::move(consume)), capacity_(capacity),
+        drain_callback_(std::move(drain_callback)), stream_id_(stream_id) {
+    worker_ = std::thread([this]() { Run(); });
+  }
+
+  ~BufferFeeder() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+      // The owner may hold the GIL while joining, which a Python callback would wait for
+      drain_callback_ = nullptr;
+    }
+    cv_.notify_all();
+    worker_.join();
+  }
+
+  // @return Whether the queue is now full
+  bool Push(std::shared_ptr<Buffer> buffer) {
+    bool full;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      PROTOTYPE_PROBE(queue_enqueue, stream_id_, queue_.size() + 1, buffer->size(),
+                      MonotonicNanos());
+      queued_bytes_ += buffer->size();
+      queue_.push_back(std::move(buffer));
+      full = full_reported_ = queued_bytes_ >= capacity_;
+    }
+    cv_.notify_all();
+    return full;
+  }
+
+  bool Full() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    full_reported_ = queued_bytes_ >= capacity_;
+    return full_reported_;
+  }
+
+  void SetDrainCallback(std::function<void()> callback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    drain_callback_ = std::move(callback);
+  }
+
+  // End the input; `done_callback` is called on the feeder thread once the queued buffers are
+  // consumed, with an empty string on success or the first error
+  void Finish(std::function<void(const std::string&)> done_callback) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      done_callback_ = std::move(done_callback);
+      closed_ = true;
+    }
+    cv_.notify_all();
+  }
+
+private:
+  void Run() {
+    Status status;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      cv_.wait(lock, [&] { return closed_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        break;
+      }
+      auto buffer = std::move(queue_.front());
+      queue_.pop_front();
+      PROTOTYPE_PROBE(queue_dequeue, stream_id_, queue_.size(), buffer->size(), MonotonicNanos());
+      lock.unlock();
+      auto size = buffer->size();
+      // After an error the rest of the input is dropped
+      if (status.ok()) {
+        status = consume_(std::move(buffer));
+      }
+      buffer.reset();
+      lock.lock();
+      queued_bytes_ -= size;
+      if (full_reported_ && queued_bytes_ < capacity_) {
+        full_reported_ = false;
+        auto drain_callback = drain_callback_;
+        if (drain_callback) {
+          lock.unlock();
+          drain_callback();
+          lock.lock();
+        }
+      }
+    }
+    auto done_callback = std::move(done_callback_);
+    lock.unlock();
+    if (done_callback) {
+      done_callback(status.ok() ? std::string() : status.ToString());
+    }
+  }
 };
 
 class StreamDecoderWrapper {
 private:
-  std::unique_ptr<arrow::ipc::StreamDecoder> decoder;
+  // Shared so that background reads (see ConsumeUri) keep the decoder alive
+  std::shared_ptr<ProjectedDecoder> decoder;
   std::shared_ptr<Listener> listener;
   Status last_status_;
+  // Buffer being filled through GetBuffer()/CommitBuffer(), and how much of it is filled
+  std::shared_ptr<ResizableBuffer> pending_buffer_;
+  int64_t pending_filled_ = 0;
+  // Hardware event totals, while counters are enabled (see EnablePerfCounters)
+  std::shared_ptr<DecoderPerfStats> perf_;
+  // Bytes queued by PushBuffer() at which QueueFull() becomes true, and the callback run once
+  // they drain
+  int64_t max_queued_bytes_;
+  std::function<void()> drain_callback_;
+  // Decodes buffers queued by PushBuffer(); declared last so it stops before the decoder goes
+  std::unique_ptr<BufferFeeder> feeder_;
 
 public:
-  StreamDecoderWrapper() {
+  // @param max_queued_bytes Bytes queued by PushBuffer() at which QueueFull() becomes true
+  explicit StreamDecoderWrapper(int64_t max_queued_bytes = int64_t{16} << 20)
+      : max_queued_bytes_(max_queued_bytes) {
     listener = std::make_shared<Listener>();
-    decoder = std::make_unique<arrow::ipc::StreamDecoder>(listener);
+    decoder = std::make_shared<ProjectedDecoder>(listener);
   }
 
   // Consume a buffer of bytes and feed them to the Arrow StreamDecoder
@@ -86,48 +1041,2823 @@ public:
   // @return Number of bytes consumed
   // @throws std::runtime_error if the decoder encounters an error
   size_t ConsumeBytes(const uint8_t* data, size_t length) {
-    last_status_ = decoder->Consume(data, length);
+    PROTOTYPE_PROBE(bytes_consumed, listener->stream_id(), length, MonotonicNanos());
+    PerfScope scope(perf_ ? &perf_->consume : nullptr, length);
+    last_status_ = decoder->Consume(data, static_cast<int64_t>(length));
     if (!last_status_.ok()) {
       throw std::runtime_error(last_status_.ToString());
     }
     return length;
   }
-  
-  // Set the callback function that will be called when a complete batch is received.
-  // @param callback Function taking a uintptr_t representing a pointer to an ArrowArrayStream
-  void SetBatchCallback(std::function<void(uintptr_t)> callback) {
-    listener->SetBatchCallback(callback);
+
+  // Number of bytes the decoder needs to make progress on the current message
+  size_t NextRequiredSize() const { return decoder->next_required_size(); }
+
+  // Get memory for the caller to fill in place (e.g. from a socket): the unfilled tail of a
+  // pending buffer, which is allocated with the decoder's next required size and kept across
+  // calls until the decoder can make progress. A message body is therefore received into a
+  // single allocation however many reads it takes, and the decoder slices it into the
+  // resulting arrays without copying.
+  // @param min_size Lower bound on the size of a new buffer, to avoid tiny reads for metadata
+  // @return The unfilled tail of the pending buffer, to be followed by CommitBuffer()
+  // @throws std::runtime_error if the allocation fails
+  std::shared_ptr<Buffer> GetBuffer(size_t min_size) {
+    if (!pending_buffer_) {
+      auto size = std::max(NextRequiredSize(), min_size);
+      auto result = arrow::AllocateResizableBuffer(static_cast<int64_t>(size));
+      if (!result.ok()) {
+        throw std::runtime_error(result.status().ToString());
+      }
+      pending_buffer_ = std::move(result).ValueUnsafe();
+      pending_filled_ = 0;
+    }
+    return arrow::SliceMutableBuffer(pending_buffer_, pending_filled_,
+                                     pending_buffer_->size() - pending_filled_);
   }
 
-  void SetSchemaCallback(std::function<void(uintptr_t)> callback) {
-      listener->SetSchemaCallback(callback);
+  // Record that `length` more bytes were written into the tail from GetBuffer(). Once the
+  // pending buffer holds the decoder's next required size (or is full), its filled part is
+  // fed to the decoder, which takes ownership; the next GetBuffer() allocates a new one.
+  // @param length Number of bytes written into the tail returned by GetBuffer()
+  // @return Number of bytes accepted
+  // @throws std::runtime_error if there is no pending buffer or the decoder fails
+  size_t CommitBuffer(size_t length) {
+    if (!pending_buffer_) {
+      throw std::runtime_error("CommitBuffer called without a pending buffer");
     }
-};
+    if (static_cast<int64_t>(length) > pending_buffer_->size() - pending_filled_) {
+      throw std::runtime_error("CommitBuffer length exceeds the pending buffer");
+    }
+    pending_filled_ += static_cast<int64_t>(length);
+    if (pending_filled_ < static_cast<int64_t>(NextRequiredSize()) &&
+        pending_filled_ < pending_buffer_->size()) {
+      return length;
+    }
+    std::shared_ptr<Buffer> buffer = std::move(pending_buffer_);
+    pending_buffer_.reset();
+    auto filled = std::exchange(pending_filled_, 0);
+    PROTOTYPE_PROBE(bytes_consumed, listener->stream_id(), filled, MonotonicNanos());
+    PerfScope scope(perf_ ? &perf_->consume : nullptr, filled);
+    last_status_ = decoder->Consume(arrow::SliceBuffer(buffer, 0, filled));
+    if (!last_status_.ok()) {
+      throw std::runtime_error(last_status_.ToString());
+    }
+    return length;
+  }
 
-NB_MODULE(prototype_cpp, m) {
-  m.doc() = "Module for processing Arrow streams over HTTP";
-  m.def("arrow_version", &get_arrow_version,
-        "Returns the major version of Arrow");
-  nb::class_<StreamDecoderWrapper>(m, "StreamDecoderWrapper")
-      .def(nb::init<>())
-      .def("set_batch_callback", &StreamDecoderWrapper::SetBatchCallback,
-           "Set the callback for processing Arrow batches")
-      .def("set_schema_callback", &StreamDecoderWrapper::SetSchemaCallback,
-          "Set the callback for receiving the Arrow schema")
-      // Bytes as input
-      .def("consume_bytes", 
-           [](StreamDecoderWrapper& self, const nb::bytes& data) {
-               return self.ConsumeBytes(
-                   reinterpret_cast<const uint8_t*>(data.c_str()),
-                   data.size()
-               );
-           })
-      // Bytearray as input
-      .def("consume_bytes",
-           [](StreamDecoderWrapper& self, const nb::bytearray& data) {
-               return self.ConsumeBytes(
-                   reinterpret_cast<const uint8_t*>(data.data()),
-                   data.size()
-               );
-           });
+  // Queue an owned buffer to be decoded on a background thread, without copying it. Meant for
+  // message-framed sources such as WebSocket frames carrying one IPC message each: a buffer
+  // holding whole messages is sliced by the decoder directly, with no reassembly.
+  // @param buffer Bytes that follow those of the previously pushed buffer
+  // @return Whether max_queued_bytes are now waiting, in which case the caller should stop
+  // pulling input until the drain callback runs
+  bool PushBuffer(std::shared_ptr<Buffer> buffer) {
+    if (!feeder_) {
+      auto stream_id = listener->stream_id();
+      feeder_ = std::make_unique<BufferFeeder>(
+          [decoder = decoder, perf = perf_, stream_id](std::shared_ptr<Buffer> block) {
+            PROTOTYPE_PROBE(bytes_consumed, stream_id, block->size(), MonotonicNanos());
+            PerfScope scope(perf ? &perf->consume : nullptr, block->size());
+            return decoder->Consume(std::move(block));
+          },
+          stream_id, max_queued_bytes_, drain_callback_);
+    }
+    return feeder_->Push(std::move(buffer));
+  }
+
+  // End the input of PushBuffer()
+  // @param done_callback Called once the pushed buffers are decoded, with an empty string on
+  // success or the error message
+  void FinishBuffers(std::function<void(const std::string&)> done_callback) {
+    if (!feeder_) {
+      done_callback(std::string());
+      return;
+    }
+    feeder_->Finish(std::move(done_callback));
+  }
+
+  // Signal the end of input. The decoder delivers each batch as soon as its message is
+  // complete, so this only notifies a BatchSink, if one is attached.
+  // @param done_callback Called right away with an empty string; the same signature as
+  // TextStreamReader::Finish, whose parser may still be busy
+  void Finish(std::function<void(const std::string&)> done_callback) {
+    listener->Finish(Status::OK());
+    done_callback(std::string());
+  }
+
+  // Whether max_queued_bytes pushed with PushBuffer() wait to be decoded. ConsumeBytes() and
+  // CommitBuffer() decode in place, so nothing queues up behind them.
+  bool QueueFull() { return feeder_ && feeder_->Full(); }
+
+  // @param callback Called on the decoding thread once the PushBuffer() queue drains after
+  // being reported full
+  void SetDrainCallback(std::function<void()> callback) {
+    drain_callback_ = callback;
+    if (feeder_) {
+      feeder_->SetDrainCallback(std::move(callback));
+    }
+  }
+
+  // Signal that reading failed, so a BatchSink sees the error instead of a clean end
+  // @param message Description of the failure
+  void Abort(const std::string& message) { listener->Finish(Status::IOError(message)); }
+
+  // Route decoded batches to an in-process consumer instead of the Python batch callback
+  void SetSink(std::shared_ptr<BatchSink> sink) { listener->SetSink(std::move(sink)); }
+
+  // Cast decoded batches to the types in `cast_to` (see Listener::SetCast)
+  void SetCast(std::shared_ptr<Schema> cast_to, bool safe) { listener->SetCast(std::move(cast_to), safe); }
+
+  // Keep only the given nested field paths. Top-level columns outside the paths are never
+  // decoded; nested children are pruned without copying (see Listener::SetProjection).
+  // Must be called before any bytes are consumed.
+  // @param paths Field paths, each starting with a top-level column name
+  // @param flatten Emit one top-level column per path instead of pruned structs
+  // @throws std::invalid_argument if there are no paths, a path is empty or bytes were
+  //         already consumed
+  void SetProjection(FieldPaths paths, bool flatten) {
+    if (paths.empty()) {
+      throw std::invalid_argument("A projection needs at least one field path");
+    }
+    std::vector<std::string> columns;
+    for (const auto& path : paths) {
+      if (path.empty()) {
+        throw std::invalid_argument("Field paths must not be empty");
+      }
+      columns.push_back(path[0]);
+    }
+    auto status = decoder->SetColumns(std::move(columns));
+    if (!status.ok()) {
+      throw std::invalid_argument(status.ToString());
+    }
+    listener->SetProjection(std::move(paths), flatten);
+  }
+
+  // Drop rows that fail any of the predicates (see Listener::SetFilter). Predicates on
+  // dictionary columns are evaluated per dictionary entry rather than per row.
+  // @param columns Column names, one per predicate
+  // @param ops Comparison operators: ==, !=, <, <=, >, >=
+  // @param values One-row batch whose i-th column holds the i-th predicate's value
+  // @throws std::invalid_argument if the arguments do not line up or an op is unknown
+  void SetFilters(const std::vector<std::string>& columns, const std::vector<std::string>& ops,
+                  const std::shared_ptr<RecordBatch>& values) {
+    listener->SetFilter(MakePredicates(columns, ops, values));
+  }
+
+  // Read an Arrow IPC stream from a filesystem URI (file://, s3://, gs://, ... or a local path)
+  // and feed it to the decoder on Arrow's I/O thread pool. Blocks of `block_size` bytes are
+  // read ahead by up to `readahead` blocks while earlier ones are being decoded; each block
+  // is handed to the decoder as an owned Buffer, so it is not copied again.
+  // Returns immediately; batch and schema callbacks are invoked from an Arrow pool thread.
+  // @param uri Filesystem URI or absolute local path
+  // @param block_size Number of bytes per read
+  // @param readahead Maximum number of blocks read ahead of the decoder
+  // @param done_callback Called once with an empty string on success or the error message
+  // @throws std::runtime_error if the filesystem or stream cannot be opened
+  void ConsumeUri(const std::string& uri, int64_t block_size, int readahead,
+                  std::function<void(const std::string&)> done_callback) {
+    auto status = StartConsumeUri(uri, block_size, readahead, std::move(done_callback));
+    if (!status.ok()) {
+      throw std::runtime_error(status.ToString());
+    }
+  }
+
+  // Count cycles, instructions, cache misses, branch misses and page faults around each
+  // consumed chunk and each exported batch, on whichever thread does the work. Counters are
+  // read with a syscall at both ends of every call, so only enable them to measure. Must be
+  // called before any input, so background reads see it.
+  // @throws std::runtime_error if perf_event_open provides none of the events
+  void EnablePerfCounters() {
+    auto status = PerfCounters::ForThisThread().CheckAvailable();
+    if (!status.ok()) {
+      throw std::runtime_error(status.ToString());
+    }
+    if (!perf_) {
+      perf_ = std::make_shared<DecoderPerfStats>();
+      listener->SetPerfStats(perf_);
+    }
+  }
+
+  // @return Totals per region: "consume" (calls, bytes and events) and "export" (calls,
+  // batches and events); empty unless counters are enabled. Events the calling thread cannot
+  // count are left out.
+  std::map<std::string, std::map<std::string, uint64_t>> PerfCounterTotals() const {
+    if (!perf_) {
+      return {};
+    }
+    const auto& counted = PerfCounters::ForThisThread();
+    return {{"consume", perf_->consume.Totals("bytes", counted)},
+            {"export", perf_->exported.Totals("batches", counted)}};
+  }
+
+  // Set the callback function that will be called when a complete batch is received.
+  // @param callback Function taking a uintptr_t representing a pointer to an ArrowArray and
+  // the SchemaCache id of the batch's schema
+  void SetBatchCallback(std::function<void(uintptr_t, uint64_t)> callback) {
+    listener->SetBatchCallback(callback);
+  }
+
+  void SetSchemaCallback(std::function<void(uint64_t)> callback) {
+      listener->SetSchemaCallback(callback);
+    }
+
+  // Id of this stream in USDT probes
+  uint64_t StreamId() const { return listener->stream_id(); }
+
+private:
+  Status StartConsumeUri(const std::string& uri, int64_t block_size, int readahead,
+                         std::function<void(const std::string&)> done_callback) {
+    if (block_size <= 0 || readahead <= 0) {
+      return Status::Invalid("block_size and readahead must be positive");
+    }
+    ARROW_ASSIGN_OR_RAISE(auto stream, OpenUri(uri));
+    ARROW_ASSIGN_OR_RAISE(auto generator, ReadAheadBlocks(std::move(stream), block_size, readahead));
+
+    auto decoder = this->decoder;
+    auto stream_id = listener->stream_id();
+    auto finished = arrow::VisitAsyncGenerator(
+        std::move(generator),
+        [decoder, perf = perf_, stream_id](const std::shared_ptr<Buffer>& block) {
+          PROTOTYPE_PROBE(bytes_consumed, stream_id, block->size(), MonotonicNanos());
+          PerfScope scope(perf ? &perf->consume : nullptr, block->size());
+          return decoder->Consume(block);
+        });
+    finished.AddCallback([decoder, done_callback = std::move(done_callback)](const Status& status) {
+      done_callback(status.ok() ? std::string() : status.ToString());
+    });
+    return Status::OK();
+  }
+};
+
+// InputStream fed with buffers from another thread.
+// Read() blocks until enough bytes have been pushed or the producer calls Finish(), so a
+// pull-based Arrow reader can run on its own thread while Python pushes network chunks.
+// Push() never blocks, since it runs on the event loop; instead the producer checks Full()
+// and stops reading from its source until the drain callback runs.
+class PushInputStream : public arrow::io::InputStream {
+private:
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::shared_ptr<Buffer>> queue_;
+  int64_t queued_bytes_ = 0;
+  int64_t capacity_;
+  // Bytes a blocked Read() is waiting for; the queue never counts as full below this
+  int64_t wanted_ = 0;
+  // Whether Full() last returned true, so the producer is waiting for the drain callback
+  bool full_reported_ = false;
+  std::function<void()> drain_callback_;
+  int64_t position_ = 0;
+  bool finished_ = false;
+  bool closed_ = false;
+
+public:
+  // @param capacity Number of queued bytes above which Full() returns true
+  explicit PushInputStream(int64_t capacity) : capacity_(capacity) {}
+
+  // Set the function called, on the reading thread and without the lock, once the queue
+  // drains after Full() returned true
+  void SetDrainCallback(std::function<void()> callback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    drain_callback_ = std::move(callback);
+  }
+
+  // Whether the producer should stop pushing until the drain callback runs
+  bool Full() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    full_reported_ = FullLocked();
+    return full_reported_;
+  }
+
+  int64_t queued_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queued_bytes_;
+  }
+
+  // Append a buffer to the stream. Buffers pushed after Close() are dropped.
+  void Push(std::shared_ptr<Buffer> buffer) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (closed_ || finished_ || buffer->size() == 0) {
+        return;
+      }
+      queued_bytes_ += buffer->size();
+      queue_.push_back(std::move(buffer));
+    }
+    cv_.notify_all();
+  }
+
+  // Mark the end of input; readers drain the queue and then see EOF
+  void Finish() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      finished_ = true;
+    }
+    cv_.notify_all();
+  }
+
+  Status Close() override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    closed_ = true;
+    queue_.clear();
+    queued_bytes_ = 0;
+    cv_.notify_all();
+    NotifyIfDrained(lock);
+    return Status::OK();
+  }
+
+  bool closed() const override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return closed_;
+  }
+
+  Result<int64_t> Tell() const override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return position_;
+  }
+
+  Result<int64_t> Read(int64_t nbytes, void* out) override {
+    ARROW_ASSIGN_OR_RAISE(auto buffer, Read(nbytes));
+    std::memcpy(out, buffer->data(), static_cast<size_t>(buffer->size()));
+    return buffer->size();
+  }
+
+  // Returns exactly `nbytes` bytes unless the stream ends first. A slice of the front buffer
+  // is returned when it is large enough; otherwise queued buffers are concatenated.
+  Result<std::shared_ptr<Buffer>> Read(int64_t nbytes) override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    // A producer paused with less than `nbytes` queued must resume, or neither side moves
+    wanted_ = nbytes;
+    NotifyIfDrained(lock);
+    cv_.wait(lock, [&] { return closed_ || finished_ || queued_bytes_ >= nbytes; });
+    wanted_ = 0;
+    if (closed_) {
+      return Status::Invalid("Stream is closed");
+    }
+    nbytes = std::min(nbytes, queued_bytes_);
+    std::shared_ptr<Buffer> result;
+    if (nbytes == 0) {
+      result = std::make_shared<Buffer>(nullptr, 0);
+    } else if (queue_.front()->size() >= nbytes) {
+      result = arrow::SliceBuffer(queue_.front(), 0, nbytes);
+      DropFront(nbytes);
+    } else {
+      ARROW_ASSIGN_OR_RAISE(auto out, arrow::AllocateBuffer(nbytes));
+      int64_t copied = 0;
+      while (copied < nbytes) {
+        auto take = std::min(nbytes - copied, queue_.front()->size());
+        std::memcpy(out->mutable_data() + copied, queue_.front()->data(), static_cast<size_t>(take));
+        copied += take;
+        DropFront(take);
+      }
+      result = std::move(out);
+    }
+    queued_bytes_ -= nbytes;
+    position_ += nbytes;
+    NotifyIfDrained(lock);
+    return result;
+  }
+
+private:
+  bool FullLocked() const {
+    return !closed_ && queued_bytes_ >= capacity_ && queued_bytes_ >= wanted_;
+  }
+
+  // Run the drain callback, with the lock released, if the producer was told the queue is
+  // full and it no longer is. The callback may need the GIL, which the producer holds while
+  // it waits for this lock.
+  void NotifyIfDrained(std::unique_lock<std::mutex>& lock) {
+    if (!full_reported_ || FullLocked()) {
+      return;
+    }
+    full_reported_ = false;
+    auto callback = drain_callback_;
+    if (!callback) {
+      return;
+    }
+    lock.unlock();
+    callback();
+    lock.lock();
+  }
+
+  // Remove `nbytes` from the front buffer, which must hold at least that many
+  void DropFront(int64_t nbytes) {
+    auto& front = queue_.front();
+    if (front->size() == nbytes) {
+      queue_.pop_front();
+    } else {
+      front = arrow::SliceBuffer(front, nbytes);
+    }
+  }
+};
+
+// Streaming CSV / newline-delimited JSON reader with the same byte-feeding interface as
+// StreamDecoderWrapper. Bytes are pushed into a PushInputStream that Arrow's streaming
+// CSV or JSON reader consumes on a background thread, without the GIL; NDJSON blocks are
+// parsed in parallel on Arrow's CPU pool. Batches are delivered through a Listener, so the
+// Python side handles them exactly like decoded IPC batches.
+class TextStreamReader {
+public:
+  enum class Format { CSV, NDJSON };
+
+private:
+  // State shared with the parsing thread
+  struct State {
+    Format format;
+    int32_t block_size;
+    std::shared_ptr<Listener> listener = std::make_shared<Listener>();
+    std::mutex mutex;
+    bool started = false;
+    bool finished = false;
+    Status status;
+    // Called by the parsing thread once it is done (see ConsumeUri and Finish)
+    std::function<void(const std::string&)> done_callback;
+  };
+  std::shared_ptr<State> state_;
+  std::shared_ptr<PushInputStream> input_;
+  std::shared_ptr<ResizableBuffer> pending_buffer_;
+  std::thread parser_thread_;
+
+public:
+  // @param format "csv" or "ndjson"
+  // @param block_size Size of the blocks handed to the parser
+  // @param max_queued_bytes Bytes waiting for the parser above which QueueFull() is true
+  // @throws std::invalid_argument for an unknown format
+  TextStreamReader(const std::string& format, int32_t block_size, int64_t max_queued_bytes) {
+    state_ = std::make_shared<State>();
+    if (format == "csv") {
+      state_->format = Format::CSV;
+    } else if (format == "ndjson") {
+      state_->format = Format::NDJSON;
+    } else {
+      throw std::invalid_argument("Unknown text format: " + format);
+    }
+    state_->block_size = block_size;
+    input_ = std::make_shared<PushInputStream>(max_queued_bytes);
+  }
+
+  ~TextStreamReader() {
+    // Unblocks the parsing thread, so that no Python callback runs once this is gone
+    input_->SetDrainCallback(nullptr);
+    (void)input_->Close();
+    if (parser_thread_.joinable()) {
+      // The thread may be waiting for the GIL to run a callback
+      nb::gil_scoped_release release;
+      parser_thread_.join();
+    }
+  }
+
+  // Copy bytes into the stream consumed by the parsing thread
+  // @return Number of bytes consumed
+  // @throws std::runtime_error if parsing has already failed
+  size_t ConsumeBytes(const uint8_t* data, size_t length) {
+    PROTOTYPE_PROBE(bytes_consumed, state_->listener->stream_id(), length, MonotonicNanos());
+    CheckStatus();
+    auto result = arrow::AllocateBuffer(static_cast<int64_t>(length));
+    if (!result.ok()) {
+      throw std::runtime_error(result.status().ToString());
+    }
+    auto buffer = std::move(result).ValueUnsafe();
+    std::memcpy(buffer->mutable_data(), data, length);
+    Start(input_);
+    input_->Push(std::move(buffer));
+    return length;
+  }
+
+  // See StreamDecoderWrapper::GetBuffer; the buffer is pushed to the parser without a copy
+  std::shared_ptr<ResizableBuffer> GetBuffer(size_t min_size) {
+    auto result = arrow::AllocateResizableBuffer(
+        static_cast<int64_t>(std::max(min_size, size_t{64 * 1024})));
+    if (!result.ok()) {
+      throw std::runtime_error(result.status().ToString());
+    }
+    pending_buffer_ = std::move(result).ValueUnsafe();
+    return pending_buffer_;
+  }
+
+  // See StreamDecoderWrapper::CommitBuffer
+  size_t CommitBuffer(size_t length) {
+    if (!pending_buffer_) {
+      throw std::runtime_error("CommitBuffer called without a pending buffer");
+    }
+    if (length > static_cast<size_t>(pending_buffer_->size())) {
+      throw std::runtime_error("CommitBuffer length exceeds the pending buffer");
+    }
+    CheckStatus();
+    std::shared_ptr<Buffer> buffer = std::move(pending_buffer_);
+    pending_buffer_.reset();
+    Start(input_);
+    input_->Push(arrow::SliceBuffer(buffer, 0, static_cast<int64_t>(length)));
+    return length;
+  }
+
+  // Whether the bytes waiting for the parser exceed max_queued_bytes, in which case the
+  // caller should stop reading from its source until the drain callback runs
+  bool QueueFull() { return input_->Full(); }
+
+  int64_t QueuedBytes() const { return input_->queued_bytes(); }
+
+  // @param callback Called on the parsing thread once the queue drains after QueueFull()
+  // returned true, or parsing stops
+  void SetDrainCallback(std::function<void()> callback) {
+    input_->SetDrainCallback(std::move(callback));
+  }
+
+  // Signal the end of input. The parser delivers the remaining batches on its own thread.
+  // @param done_callback Called once parsing is done, with an empty string on success or the
+  // error message; on the calling thread if it already is
+  void Finish(std::function<void(const std::string&)> done_callback) {
+    Start(input_);
+    input_->Finish();
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    if (!state_->finished) {
+      state_->done_callback = std::move(done_callback);
+      return;
+    }
+    auto status = state_->status;
+    lock.unlock();
+    done_callback(status.ok() ? std::string() : status.ToString());
+  }
+
+  // Parse a filesystem URI directly on the background thread
+  // @param uri Filesystem URI or absolute local path
+  // @param done_callback Called once with an empty string on success or the error message
+  // @throws std::runtime_error if the filesystem or stream cannot be opened
+  void ConsumeUri(const std::string& uri, std::function<void(const std::string&)> done_callback) {
+    std::string path;
+    auto filesystem = arrow::fs::FileSystemFromUriOrPath(uri, &path);
+    if (!filesystem.ok()) {
+      throw std::runtime_error(filesystem.status().ToString());
+    }
+    auto stream = (*filesystem)->OpenInputStream(path);
+    if (!stream.ok()) {
+      throw std::runtime_error(stream.status().ToString());
+    }
+    Start(*stream, std::move(done_callback));
+  }
+
+  // Cast parsed batches to the types in `cast_to` (see Listener::SetCast)
+  void SetCast(std::shared_ptr<Schema> cast_to, bool safe) {
+    state_->listener->SetCast(std::move(cast_to), safe);
+  }
+
+  void SetBatchCallback(std::function<void(uintptr_t, uint64_t)> callback) {
+    state_->listener->SetBatchCallback(callback);
+  }
+
+  void SetSchemaCallback(std::function<void(uint64_t)> callback) {
+    state_->listener->SetSchemaCallback(callback);
+  }
+
+private:
+  void CheckStatus() {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    if (state_->finished && !state_->status.ok()) {
+      throw std::runtime_error(state_->status.ToString());
+    }
+  }
+
+  // Launch the parsing thread on first use
+  void Start(std::shared_ptr<arrow::io::InputStream> input,
+             std::function<void(const std::string&)> done_callback = nullptr) {
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      if (state_->started) {
+        return;
+      }
+      state_->started = true;
+      state_->done_callback = std::move(done_callback);
+    }
+    parser_thread_ = std::thread([state = state_, input = std::move(input)]() {
+      auto status = Parse(*state, input);
+      if (!status.ok()) {
+        (void)input->Close();
+      }
+      std::function<void(const std::string&)> done_callback;
+      {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->status = status;
+        state->finished = true;
+        done_callback = std::move(state->done_callback);
+      }
+      if (done_callback) {
+        done_callback(status.ok() ? std::string() : status.ToString());
+      }
+    });
+  }
+
+  static Status Parse(State& state, std::shared_ptr<arrow::io::InputStream> input) {
+    std::shared_ptr<RecordBatchReader> reader;
+    if (state.format == Format::CSV) {
+      auto read_options = arrow::csv::ReadOptions::Defaults();
+      read_options.block_size = state.block_size;
+      ARROW_ASSIGN_OR_RAISE(
+          reader, arrow::csv::StreamingReader::Make(
+                      arrow::io::default_io_context(), input, read_options,
+                      arrow::csv::ParseOptions::Defaults(),
+                      arrow::csv::ConvertOptions::Defaults()));
+    } else {
+      auto read_options = arrow::json::ReadOptions::Defaults();
+      read_options.block_size = state.block_size;
+      ARROW_ASSIGN_OR_RAISE(
+          reader, arrow::json::StreamingReader::Make(
+                      input, read_options, arrow::json::ParseOptions::Defaults(),
+                      arrow::io::default_io_context(), arrow::internal::GetCpuThreadPool()));
+    }
+    ARROW_RETURN_NOT_OK(state.listener->OnSchemaDecoded(reader->schema()));
+    while (true) {
+      ARROW_ASSIGN_OR_RAISE(auto batch, reader->Next());
+      if (!batch) {
+        return Status::OK();
+      }
+      ARROW_RETURN_NOT_OK(state.listener->OnRecordBatchDecoded(batch));
+    }
+  }
+};
+
+// Read-only RandomAccessFile whose reads are served by a callback, e.g. HTTP range requests
+// issued from Python. ReadAsync falls back to ReadAt on the I/O pool, so the coalesced ranges
+// requested by Parquet's pre-buffering are fetched concurrently.
+class RangeCallbackFile : public arrow::io::RandomAccessFile {
+private:
+  std::function<std::string(int64_t, int64_t)> read_range_;
+  int64_t size_;
+  mutable std::mutex mutex_;
+  int64_t position_ = 0;
+  bool closed_ = false;
+
+public:
+  // @param size Total size of the file in bytes
+  // @param read_range Returns exactly `length` bytes starting at `offset`
+  RangeCallbackFile(int64_t size, std::function<std::string(int64_t, int64_t)> read_range)
+      : read_range_(std::move(read_range)), size_(size) {}
+
+  Status Close() override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    return Status::OK();
+  }
+
+  bool closed() const override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return closed_;
+  }
+
+  Result<int64_t> Tell() const override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return position_;
+  }
+
+  Status Seek(int64_t position) override {
+    if (position < 0 || position > size_) {
+      return Status::IOError("Seek out of bounds");
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    position_ = position;
+    return Status::OK();
+  }
+
+  Result<int64_t> GetSize() override { return size_; }
+
+  Result<int64_t> Read(int64_t nbytes, void* out) override {
+    ARROW_ASSIGN_OR_RAISE(auto buffer, Read(nbytes));
+    std::memcpy(out, buffer->data(), static_cast<size_t>(buffer->size()));
+    return buffer->size();
+  }
+
+  Result<std::shared_ptr<Buffer>> Read(int64_t nbytes) override {
+    ARROW_ASSIGN_OR_RAISE(auto position, Tell());
+    ARROW_ASSIGN_OR_RAISE(auto buffer, ReadAt(position, nbytes));
+    std::lock_guard<std::mutex> lock(mutex_);
+    position_ = position + buffer->size();
+    return buffer;
+  }
+
+  Result<int64_t> ReadAt(int64_t position, int64_t nbytes, void* out) override {
+    ARROW_ASSIGN_OR_RAISE(auto buffer, ReadAt(position, nbytes));
+    std::memcpy(out, buffer->data(), static_cast<size_t>(buffer->size()));
+    return buffer->size();
+  }
+
+  Result<std::shared_ptr<Buffer>> ReadAt(int64_t position, int64_t nbytes) override {
+    nbytes = std::min(nbytes, size_ - position);
+    if (nbytes <= 0) {
+      return std::make_shared<Buffer>(nullptr, 0);
+    }
+    std::string data;
+    try {
+      data = read_range_(position, nbytes);
+    } catch (const std::exception& e) {
+      return Status::IOError(e.what());
+    }
+    if (static_cast<int64_t>(data.size()) != nbytes) {
+      return Status::IOError("Range read returned ", data.size(), " bytes, expected ", nbytes);
+    }
+    return Buffer::FromString(std::move(data));
+  }
+};
+
+// Parquet reader over a RangeCallbackFile. Only the footer, the column chunks of projected
+// columns and the row groups whose statistics may satisfy the filters are fetched; Parquet's
+// pre-buffering coalesces adjacent ranges into single requests, and row groups are decoded
+// in parallel on Arrow's CPU pool. Batches are delivered through a Listener.
+class ParquetSource {
+private:
+  std::shared_ptr<Listener> listener_ = std::make_shared<Listener>();
+  // A conjunction of predicates, used to prune row groups
+  std::vector<ColumnPredicate> filters_;
+
+public:
+  // Set predicates that row groups must possibly satisfy, all of which must hold.
+  // @param columns Column names, one per predicate
+  // @param ops Comparison operators: ==, !=, <, <=, >, >=
+  // @param values One-row batch whose i-th column holds the i-th predicate's value
+  // @throws std::invalid_argument if the arguments do not line up or an op is unknown
+  void SetFilters(const std::vector<std::string>& columns, const std::vector<std::string>& ops,
+                  const std::shared_ptr<RecordBatch>& values) {
+    filters_ = MakePredicates(columns, ops, values);
+  }
+
+  // Read the file on a background thread; returns immediately.
+  // `read_range` must not be served from the calling thread, which it may block on.
+  // @param size Total size of the file in bytes
+  // @param read_range Returns exactly `length` bytes starting at `offset`
+  // @param columns Top-level columns to read, or empty for all
+  // @param batch_size Maximum number of rows per batch
+  // @param readahead Maximum number of row groups decoded ahead of delivery
+  // @param done_callback Called once with an empty string on success or the error message
+  void Start(int64_t size, std::function<std::string(int64_t, int64_t)> read_range,
+             std::vector<std::string> columns, int64_t batch_size, int readahead,
+             std::function<void(const std::string&)> done_callback) {
+    auto file = std::make_shared<RangeCallbackFile>(size, std::move(read_range));
+    StartThread([file]() -> Result<std::shared_ptr<arrow::io::RandomAccessFile>> { return file; },
+                std::move(columns), batch_size, readahead, std::move(done_callback));
+  }
+
+  // Same as Start(), reading from a filesystem URI (file://, s3://, ... or a local path)
+  void StartUri(const std::string& uri, std::vector<std::string> columns, int64_t batch_size,
+                int readahead, std::function<void(const std::string&)> done_callback) {
+    StartThread(
+        [uri]() -> Result<std::shared_ptr<arrow::io::RandomAccessFile>> {
+          std::string path;
+          ARROW_ASSIGN_OR_RAISE(auto filesystem, arrow::fs::FileSystemFromUriOrPath(uri, &path));
+          return filesystem->OpenInputFile(path);
+        },
+        std::move(columns), batch_size, readahead, std::move(done_callback));
+  }
+
+  // Cast decoded batches to the types in `cast_to` (see Listener::SetCast)
+  void SetCast(std::shared_ptr<Schema> cast_to, bool safe) {
+    listener_->SetCast(std::move(cast_to), safe);
+  }
+
+  void SetBatchCallback(std::function<void(uintptr_t, uint64_t)> callback) {
+    listener_->SetBatchCallback(callback);
+  }
+
+  void SetSchemaCallback(std::function<void(uint64_t)> callback) {
+    listener_->SetSchemaCallback(callback);
+  }
+
+private:
+  void StartThread(std::function<Result<std::shared_ptr<arrow::io::RandomAccessFile>>()> open,
+                   std::vector<std::string> columns, int64_t batch_size, int readahead,
+                   std::function<void(const std::string&)> done_callback) {
+    std::thread([open = std::move(open), listener = listener_, filters = filters_,
+                 columns = std::move(columns), batch_size, readahead,
+                 done_callback = std::move(done_callback)]() {
+      auto file = open();
+      auto status = file.ok() ? Read(*file, *listener, filters, columns, batch_size, readahead)
+                              : file.status();
+      done_callback(status.ok() ? std::string() : status.ToString());
+    }).detach();
+  }
+
+  static Result<bool> Compare(const char* function, const std::shared_ptr<Scalar>& left,
+                              const std::shared_ptr<Scalar>& right) {
+    ARROW_ASSIGN_OR_RAISE(auto result, arrow::compute::CallFunction(function, {left, right}));
+    const auto& scalar = checked_cast<const BooleanScalar&>(*result.scalar());
+    return scalar.is_valid && scalar.value;
+  }
+
+  // Whether any value in [min, max] can satisfy `value op filter.value`
+  static Result<bool> CanMatch(const ColumnPredicate& filter, const std::shared_ptr<Scalar>& min,
+                               const std::shared_ptr<Scalar>& max) {
+    ARROW_ASSIGN_OR_RAISE(auto cast, arrow::compute::Cast(filter.value, min->type));
+    auto value = cast.scalar();
+    const auto& op = filter.op;
+    if (op == "==") {
+      ARROW_ASSIGN_OR_RAISE(auto below, Compare("less", value, min));
+      ARROW_ASSIGN_OR_RAISE(auto above, Compare("greater", value, max));
+      return !below && !above;
+    }
+    if (op == "!=") {
+      ARROW_ASSIGN_OR_RAISE(auto min_equal, Compare("equal", min, value));
+      ARROW_ASSIGN_OR_RAISE(auto max_equal, Compare("equal", max, value));
+      return !(min_equal && max_equal);
+    }
+    // For <, <= the smallest value decides; for >, >= the largest
+    return Compare(CompareFunction(op), op[0] == '<' ? min : max, value);
+  }
+
+  static Result<std::vector<int>> PruneRowGroups(const parquet::FileMetaData& metadata,
+                                                 const std::vector<ColumnPredicate>& filters) {
+    std::vector<int> leaves;
+    for (const auto& filter : filters) {
+      auto leaf = metadata.schema()->ColumnIndex(filter.column);
+      if (leaf < 0) {
+        return Status::KeyError("Filter column not found: ", filter.column);
+      }
+      leaves.push_back(leaf);
+    }
+    std::vector<int> row_groups;
+    for (int i = 0; i < metadata.num_row_groups(); i++) {
+      auto row_group = metadata.RowGroup(i);
+      bool keep = true;
+      for (size_t f = 0; f < filters.size() && keep; f++) {
+        auto stats = row_group->ColumnChunk(leaves[f])->statistics();
+        std::shared_ptr<Scalar> min, max;
+        if (!stats || !stats->HasMinMax() ||
+            !parquet::arrow::StatisticsAsScalars(*stats, &min, &max).ok()) {
+          continue;  // no usable statistics, so the row group cannot be ruled out
+        }
+        ARROW_ASSIGN_OR_RAISE(keep, CanMatch(filters[f], min, max));
+      }
+      if (keep) {
+        row_groups.push_back(i);
+      }
+    }
+    return row_groups;
+  }
+
+  static Status Read(std::shared_ptr<arrow::io::RandomAccessFile> file, Listener& listener,
+                     const std::vector<ColumnPredicate>& filters, const std::vector<std::string>& columns,
+                     int64_t batch_size, int readahead) {
+    parquet::ArrowReaderProperties properties;
+    properties.set_pre_buffer(true);
+    properties.set_cache_options(arrow::io::CacheOptions::Defaults());
+    properties.set_use_threads(true);
+    properties.set_batch_size(batch_size);
+
+    // Opening fetches the footer
+    parquet::arrow::FileReaderBuilder builder;
+    ARROW_RETURN_NOT_OK(builder.Open(file));
+    ARROW_ASSIGN_OR_RAISE(std::shared_ptr<parquet::arrow::FileReader> reader,
+                          builder.properties(properties)->Build());
+
+    std::shared_ptr<Schema> schema;
+    ARROW_RETURN_NOT_OK(reader->GetSchema(&schema));
+    std::vector<int> fields;
+    if (columns.empty()) {
+      for (int i = 0; i < schema->num_fields(); i++) {
+        fields.push_back(i);
+      }
+    } else {
+      for (const auto& name : columns) {
+        auto index = schema->GetFieldIndex(name);
+        if (index < 0) {
+          return Status::KeyError("Column not found: ", name);
+        }
+        fields.push_back(index);
+      }
+    }
+    FieldVector projected;
+    for (auto i : fields) {
+      projected.push_back(schema->field(i));
+    }
+    ARROW_RETURN_NOT_OK(listener.OnSchemaDecoded(arrow::schema(projected, schema->metadata())));
+
+    auto metadata = reader->parquet_reader()->metadata();
+    ARROW_ASSIGN_OR_RAISE(auto row_groups, PruneRowGroups(*metadata, filters));
+    if (row_groups.empty()) {
+      return Status::OK();
+    }
+    ARROW_ASSIGN_OR_RAISE(auto leaves, reader->manifest().GetFieldIndices(fields));
+
+    // Read ahead by whole row groups so several are fetched and decoded concurrently
+    int64_t rows_to_readahead = 0;
+    for (int i = 0; i < readahead && i < static_cast<int>(row_groups.size()); i++) {
+      rows_to_readahead += metadata->RowGroup(row_groups[i])->num_rows();
+    }
+    ARROW_ASSIGN_OR_RAISE(
+        auto generator,
+        reader->GetRecordBatchGenerator(reader, row_groups, leaves,
+                                        arrow::internal::GetCpuThreadPool(), rows_to_readahead));
+    while (true) {
+      auto next = generator();
+      ARROW_ASSIGN_OR_RAISE(auto batch, next.result());
+      if (arrow::IsIterationEnd(batch)) {
+        return Status::OK();
+      }
+      ARROW_RETURN_NOT_OK(listener.OnRecordBatchDecoded(batch));
+    }
+  }
+};
+
+// Decode a Substrait ExtendedExpression message, as produced by
+// pyarrow.substrait.serialize_expressions, into (name, expression) pairs
+Result<std::vector<std::pair<std::string, arrow::compute::Expression>>> DeserializeExpressions(
+    const Buffer& buffer) {
+#ifdef PROTOTYPE_WITH_SUBSTRAIT
+  ARROW_ASSIGN_OR_RAISE(auto bound, arrow::engine::DeserializeExpressions(buffer));
+  std::vector<std::pair<std::string, arrow::compute::Expression>> expressions;
+  for (auto& named : bound.named_expressions) {
+    expressions.emplace_back(named.name, std::move(named.expression));
+  }
+  return expressions;
+#else
+  return Status::NotImplemented("Built without Substrait support; expressions are unavailable");
+#endif
+}
+
+// One input stream of an AceroPlan. Decoded batches are pushed straight into the
+// generator of an Acero source node, without going through Python.
+class AceroInput : public BatchSink {
+private:
+  using Generator = arrow::PushGenerator<std::optional<arrow::compute::ExecBatch>>;
+  Generator generator_;
+  Generator::Producer producer_ = generator_.producer();
+  Future<std::shared_ptr<Schema>> schema_ = Future<std::shared_ptr<Schema>>::Make();
+  std::mutex mutex_;
+  bool finished_ = false;
+
+public:
+  Status OnSchema(const std::shared_ptr<Schema>& schema) override {
+    if (!schema_.is_finished()) {
+      schema_.MarkFinished(schema);
+    }
+    return Status::OK();
+  }
+
+  Status OnBatch(const std::shared_ptr<RecordBatch>& batch) override {
+    producer_.Push(std::make_optional(arrow::compute::ExecBatch(*batch)));
+    return Status::OK();
+  }
+
+  void OnFinish(const Status& status) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (finished_) {
+      return;
+    }
+    finished_ = true;
+    if (!status.ok()) {
+      producer_.Push(status);
+    }
+    producer_.Close();
+    if (!schema_.is_finished()) {
+      schema_.MarkFinished(status.ok() ? Status::Invalid("Stream ended before its schema") : status);
+    }
+  }
+
+  // A source declaration for this input; blocks until the stream's schema is known
+  Result<arrow::acero::Declaration> Source() {
+    ARROW_ASSIGN_OR_RAISE(auto schema, schema_.result());
+    return arrow::acero::Declaration(
+        "source", arrow::acero::SourceNodeOptions(schema, generator_));
+  }
+};
+
+// Runs an Acero plan whose sources are streams decoded by StreamDecoderWrappers.
+// The plan is built either from a few declaration options or from a Substrait plan whose
+// named tables refer to the inputs. It executes on Acero's CPU pool, and its output is
+// delivered through a Listener like any decoded stream.
+class AceroPlan {
+private:
+  std::map<std::string, std::shared_ptr<AceroInput>> inputs_;
+  std::shared_ptr<Listener> listener_ = std::make_shared<Listener>();
+
+public:
+  // Route the batches decoded by `wrapper` into the plan as the table `name`
+  void AddInput(const std::string& name, StreamDecoderWrapper& wrapper) {
+    auto input = std::make_shared<AceroInput>();
+    wrapper.SetSink(input);
+    inputs_[name] = std::move(input);
+  }
+
+  // Run source -> filter -> project -> aggregate over the single input.
+  // Expressions are Substrait ExtendedExpression messages, as produced by
+  // pyarrow.substrait.serialize_expressions; empty means the step is skipped.
+  // @param filter_buffer Serialized filter expression
+  // @param projection_buffer Serialized named expressions to project
+  // @param columns Names of columns to keep, when there is no projection
+  // @param group_by Names of the grouping keys for the aggregation
+  // @param aggregates (function, column, output name) triples, e.g. ("sum", "x", "total")
+  // @param done_callback Called once with an empty string on success or the error message
+  // @throws std::invalid_argument unless exactly one input has been added
+  void StartDeclaration(std::shared_ptr<Buffer> filter_buffer,
+                        std::shared_ptr<Buffer> projection_buffer,
+                        std::vector<std::string> columns, std::vector<std::string> group_by,
+                        std::vector<std::tuple<std::string, std::string, std::string>> aggregates,
+                        std::function<void(const std::string&)> done_callback) {
+    if (inputs_.size() != 1) {
+      throw std::invalid_argument("A declaration plan needs exactly one input");
+    }
+    auto input = inputs_.begin()->second;
+    Run(
+        [=]() -> Result<arrow::acero::Declaration> {
+          ARROW_ASSIGN_OR_RAISE(auto declaration, input->Source());
+          if (filter_buffer->size() > 0) {
+            ARROW_ASSIGN_OR_RAISE(auto filter_expressions, DeserializeExpressions(*filter_buffer));
+            if (filter_expressions.size() != 1) {
+              return Status::Invalid("Expected a single filter expression");
+            }
+            declaration = arrow::acero::Declaration(
+                "filter", {std::move(declaration)},
+                arrow::acero::FilterNodeOptions(filter_expressions[0].second));
+          }
+          std::vector<arrow::compute::Expression> expressions;
+          std::vector<std::string> names;
+          if (projection_buffer->size() > 0) {
+            ARROW_ASSIGN_OR_RAISE(auto projected, DeserializeExpressions(*projection_buffer));
+            for (auto& [name, expression] : projected) {
+              names.push_back(name);
+              expressions.push_back(expression);
+            }
+          } else {
+            for (const auto& column : columns) {
+              expressions.push_back(arrow::compute::field_ref(column));
+              names.push_back(column);
+            }
+          }
+          if (!expressions.empty()) {
+            declaration = arrow::acero::Declaration(
+                "project", {std::move(declaration)},
+                arrow::acero::ProjectNodeOptions(std::move(expressions), std::move(names)));
+          }
+          if (!aggregates.empty()) {
+            std::vector<arrow::compute::Aggregate> aggs;
+            for (const auto& [function, column, name] : aggregates) {
+              // Grouped aggregations use the hash_ variant of each function
+              auto kernel = group_by.empty() ? function : "hash_" + function;
+              std::vector<FieldRef> target;
+              if (!column.empty()) {
+                target.emplace_back(column);
+              }
+              aggs.emplace_back(kernel, nullptr, std::move(target), name);
+            }
+            std::vector<FieldRef> keys(group_by.begin(), group_by.end());
+            declaration = arrow::acero::Declaration(
+                "aggregate", {std::move(declaration)},
+                arrow::acero::AggregateNodeOptions(std::move(aggs), std::move(keys)));
+          }
+          return declaration;
+        },
+        std::move(done_callback));
+  }
+
+  // Run a serialized Substrait plan; its named tables are resolved to the added inputs.
+  // @param plan_buffer Serialized substrait.Plan message
+  // @param done_callback Called once with an empty string on success or the error message
+  void StartSubstrait(std::shared_ptr<Buffer> plan_buffer,
+                      std::function<void(const std::string&)> done_callback) {
+    auto inputs = inputs_;
+    Run(
+        [plan_buffer, inputs]() -> Result<arrow::acero::Declaration> {
+#ifdef PROTOTYPE_WITH_SUBSTRAIT
+          arrow::engine::ConversionOptions options;
+          options.named_table_provider =
+              [inputs](const std::vector<std::string>& names,
+                       const Schema&) -> Result<arrow::acero::Declaration> {
+            auto it = names.empty() ? inputs.end() : inputs.find(names.back());
+            if (it == inputs.end()) {
+              return Status::KeyError("No input stream for named table ",
+                                      names.empty() ? "" : names.back());
+            }
+            return it->second->Source();
+          };
+          ARROW_ASSIGN_OR_RAISE(auto info, arrow::engine::DeserializePlan(*plan_buffer, nullptr,
+                                                                         nullptr, options));
+          auto declaration = std::move(info.root.declaration);
+          // Apply the plan's output names, if it has a RelRoot
+          if (!info.names.empty() &&
+              static_cast<int>(info.names.size()) == info.root.output_schema->num_fields()) {
+            std::vector<arrow::compute::Expression> fields;
+            for (int i = 0; i < info.root.output_schema->num_fields(); i++) {
+              fields.push_back(arrow::compute::field_ref(i));
+            }
+            declaration = arrow::acero::Declaration(
+                "project", {std::move(declaration)},
+                arrow::acero::ProjectNodeOptions(std::move(fields), info.names));
+          }
+          return declaration;
+#else
+          return Status::NotImplemented("Built without Substrait support");
+#endif
+        },
+        std::move(done_callback));
+  }
+
+  void SetBatchCallback(std::function<void(uintptr_t, uint64_t)> callback) {
+    listener_->SetBatchCallback(callback);
+  }
+
+  void SetSchemaCallback(std::function<void(uint64_t)> callback) {
+    listener_->SetSchemaCallback(callback);
+  }
+
+private:
+  // Build and execute the plan on a background thread, which waits for the input schemas
+  void Run(std::function<Result<arrow::acero::Declaration>()> build,
+           std::function<void(const std::string&)> done_callback) {
+    std::thread([build = std::move(build), listener = listener_,
+                 done_callback = std::move(done_callback)]() {
+      auto status = Execute(build, *listener);
+      done_callback(status.ok() ? std::string() : status.ToString());
+    }).detach();
+  }
+
+  static Status Execute(const std::function<Result<arrow::acero::Declaration>()>& build,
+                        Listener& listener) {
+    ARROW_ASSIGN_OR_RAISE(auto declaration, build());
+    ARROW_ASSIGN_OR_RAISE(auto reader,
+                          arrow::acero::DeclarationToReader(std::move(declaration), true));
+    ARROW_RETURN_NOT_OK(listener.OnSchemaDecoded(reader->schema()));
+    while (true) {
+      ARROW_ASSIGN_OR_RAISE(auto batch, reader->Next());
+      if (!batch) {
+        return reader->Close();
+      }
+      ARROW_RETURN_NOT_OK(listener.OnRecordBatchDecoded(batch));
+    }
+  }
+};
+
+// Opens the byte stream behind a URL; used for URLs that Arrow's filesystems cannot open
+using StreamOpener = std::function<Result<std::shared_ptr<arrow::io::InputStream>>(const std::string&)>;
+
+// InputStream whose reads are served by a callback, e.g. an HTTP response read from Python.
+// The callback returns up to `nbytes` bytes, and an empty result at the end of the stream.
+// The optional close callback releases the source; it runs on Close() or, for streams
+// dropped early (e.g. by a scan that stops), on destruction.
+class ReadCallbackStream : public arrow::io::InputStream {
+private:
+  std::function<std::string(int64_t)> read_;
+  std::function<void()> close_;
+  int64_t position_ = 0;
+  bool eof_ = false;
+  bool closed_ = false;
+
+public:
+  explicit ReadCallbackStream(std::function<std::string(int64_t)> read,
+                              std::function<void()> close = nullptr)
+      : read_(std::move(read)), close_(std::move(close)) {}
+
+  ~ReadCallbackStream() override { (void)Close(); }
+
+  Status Close() override {
+    if (closed_) {
+      return Status::OK();
+    }
+    closed_ = true;
+    read_ = nullptr;
+    auto close = std::move(close_);
+    close_ = nullptr;
+    if (close) {
+      try {
+        close();
+      } catch (const std::exception& e) {
+        return Status::IOError(e.what());
+      }
+    }
+    return Status::OK();
+  }
+
+  bool closed() const override { return closed_; }
+
+  Result<int64_t> Tell() const override { return position_; }
+
+  Result<int64_t> Read(int64_t nbytes, void* out) override {
+    ARROW_ASSIGN_OR_RAISE(auto buffer, Read(nbytes));
+    std::memcpy(out, buffer->data(), static_cast<size_t>(buffer->size()));
+    return buffer->size();
+  }
+
+  // Returns exactly `nbytes` bytes unless the stream ends first
+  Result<std::shared_ptr<Buffer>> Read(int64_t nbytes) override {
+    if (closed_) {
+      return Status::Invalid("Operation on closed stream");
+    }
+    std::string data;
+    while (!eof_ && static_cast<int64_t>(data.size()) < nbytes) {
+      std::string chunk;
+      try {
+        chunk = read_(nbytes - static_cast<int64_t>(data.size()));
+      } catch (const std::exception& e) {
+        return Status::IOError(e.what());
+      }
+      eof_ = chunk.empty();
+      data += chunk;
+    }
+    position_ += static_cast<int64_t>(data.size());
+    return Buffer::FromString(std::move(data));
+  }
+};
+
+// Add the comparisons of a column with a literal among the conjuncts of a scan filter to
+// `predicates`. Other conjuncts are skipped, so a RowFilter built from the predicates may keep
+// rows the filter drops but never drops a row it keeps.
+void CollectPredicates(const arrow::compute::Expression& filter, const Schema& schema,
+                       std::vector<ColumnPredicate>* predicates) {
+  auto call = filter.call();
+  if (!call) {
+    return;
+  }
+  if (call->function_name == "and_kleene" || call->function_name == "and") {
+    for (const auto& argument : call->arguments) {
+      CollectPredicates(argument, schema, predicates);
+    }
+    return;
+  }
+  // Function name, op, and the op with its operands swapped
+  static const std::array<std::array<const char*, 3>, 6> kComparisons = {{
+      {"equal", "==", "=="},
+      {"not_equal", "!=", "!="},
+      {"less", "<", ">"},
+      {"less_equal", "<=", ">="},
+      {"greater", ">", "<"},
+      {"greater_equal", ">=", "<="},
+  }};
+  auto comparison = std::find_if(kComparisons.begin(), kComparisons.end(),
+                                 [&](const auto& c) { return call->function_name == c[0]; });
+  if (comparison == kComparisons.end() || call->arguments.size() != 2) {
+    return;
+  }
+  auto swapped = call->arguments[0].literal() != nullptr;
+  auto ref = call->arguments[swapped ? 1 : 0].field_ref();
+  auto literal = call->arguments[swapped ? 0 : 1].literal();
+  if (!ref || !ref->IsName() || !literal || !literal->is_scalar() ||
+      schema.GetFieldIndex(*ref->name()) < 0) {
+    return;
+  }
+  predicates->push_back({*ref->name(), (*comparison)[swapped ? 2 : 1], literal->scalar()});
+}
+
+// Dataset fragment over one Arrow IPC stream. The stream is read ahead on the I/O pool and
+// decoded as the scanner pulls batches; only the columns the scan materializes are decoded,
+// which include the filter's columns, and the scanner drops those after filtering.
+// Comparisons of a column with a literal in the filter are also applied by a RowFilter as
+// batches are decoded, so rows they reject never reach the scanner; it still evaluates the
+// whole filter on the rest.
+class StreamFragment : public arrow::dataset::Fragment {
+private:
+  std::string uri_;
+  StreamOpener open_;
+  int64_t block_size_;
+  int readahead_;
+  // Stream opened to read the schema, and the blocks read from it, kept for the next scan so
+  // that discovering the schema does not fetch the stream twice
+  std::mutex probe_mutex_;
+  std::shared_ptr<arrow::io::InputStream> probed_stream_;
+  std::vector<std::shared_ptr<Buffer>> probed_blocks_;
+
+public:
+  // @param schema The stream's schema, or null to read it from the stream when needed
+  StreamFragment(std::string uri, std::shared_ptr<Schema> schema, StreamOpener open,
+                 int64_t block_size, int readahead)
+      : Fragment(arrow::compute::literal(true), std::move(schema)), uri_(std::move(uri)),
+        open_(std::move(open)), block_size_(block_size), readahead_(readahead) {}
+
+  Result<arrow::dataset::RecordBatchGenerator> ScanBatchesAsync(
+      const std::shared_ptr<arrow::dataset::ScanOptions>& options) override {
+    ARROW_ASSIGN_OR_RAISE(auto schema, ReadPhysicalSchema());
+    auto read_options = arrow::ipc::IpcReadOptions::Defaults();
+    for (const auto& ref : options->MaterializedFields()) {
+      // Fields missing from this stream are filled with nulls by the scanner
+      auto path = ref.FindOneOrNone(*schema);
+      if (path.ok() && !path->empty()) {
+        read_options.included_fields.push_back((*path)[0]);
+      }
+    }
+    std::sort(read_options.included_fields.begin(), read_options.included_fields.end());
+    read_options.included_fields.erase(
+        std::unique(read_options.included_fields.begin(), read_options.included_fields.end()),
+        read_options.included_fields.end());
+    if (read_options.included_fields.empty() && schema->num_fields() > 0) {
+      // Nothing is materialized (e.g. counting rows), but a batch still needs one column
+      read_options.included_fields.push_back(0);
+    }
+
+    std::shared_ptr<arrow::io::InputStream> stream;
+    std::vector<std::shared_ptr<Buffer>> probed_blocks;
+    {
+      std::lock_guard<std::mutex> lock(probe_mutex_);
+      stream = std::move(probed_stream_);
+      probed_blocks = std::move(probed_blocks_);
+      probed_blocks_.clear();
+    }
+    if (!stream) {
+      ARROW_ASSIGN_OR_RAISE(stream, open_(uri_));
+    }
+    std::vector<ColumnPredicate> predicates;
+    CollectPredicates(options->filter, *schema, &predicates);
+    std::shared_ptr<RowFilter> row_filter;
+    if (!predicates.empty()) {
+      row_filter = std::make_shared<RowFilter>(std::move(predicates));
+    }
+
+    auto listener = std::make_shared<CollectingListener>();
+    auto decoder = std::make_shared<arrow::ipc::StreamDecoder>(listener, read_options);
+    // The probe read exactly up to the end of the schema message, so this yields no batches
+    for (auto& block : probed_blocks) {
+      ARROW_RETURN_NOT_OK(decoder->Consume(std::move(block)));
+    }
+    ARROW_ASSIGN_OR_RAISE(auto blocks, ReadAheadBlocks(std::move(stream), block_size_, readahead_));
+    auto decoded = arrow::MakeMappedGenerator(
+        std::move(blocks),
+        [decoder, listener, row_filter](const std::shared_ptr<Buffer>& block)
+            -> Result<arrow::dataset::RecordBatchGenerator> {
+          ARROW_RETURN_NOT_OK(decoder->Consume(block));
+          auto batches = std::move(listener->batches);
+          listener->batches.clear();
+          if (row_filter) {
+            RecordBatchVector kept;
+            for (const auto& batch : batches) {
+              ARROW_ASSIGN_OR_RAISE(auto filtered, row_filter->Apply(batch));
+              if (filtered->num_rows() > 0) {
+                kept.push_back(std::move(filtered));
+              }
+            }
+            batches = std::move(kept);
+          }
+          return arrow::MakeVectorGenerator(std::move(batches));
+        });
+    return arrow::MakeConcatenatedGenerator(std::move(decoded));
+  }
+
+  std::string type_name() const override { return "arrow_stream"; }
+
+  std::string ToString() const override { return uri_; }
+
+protected:
+  // Read blocks until the schema message has been decoded; the stream is left open for the
+  // next scan to continue from
+  Result<std::shared_ptr<Schema>> ReadPhysicalSchemaImpl() override {
+    ARROW_ASSIGN_OR_RAISE(auto stream, open_(uri_));
+    auto listener = std::make_shared<CollectingListener>();
+    arrow::ipc::StreamDecoder decoder(listener);
+    std::vector<std::shared_ptr<Buffer>> blocks;
+    while (!listener->schema) {
+      ARROW_ASSIGN_OR_RAISE(auto block, stream->Read(decoder.next_required_size()));
+      if (block->size() == 0) {
+        return Status::Invalid("Stream ", uri_, " ended before its schema");
+      }
+      ARROW_RETURN_NOT_OK(decoder.Consume(block));
+      blocks.push_back(std::move(block));
+    }
+    std::lock_guard<std::mutex> lock(probe_mutex_);
+    probed_stream_ = std::move(stream);
+    probed_blocks_ = std::move(blocks);
+    return listener->schema;
+  }
+};
+
+// Dataset with one StreamFragment per URL. Scanning it with Arrow's scanner reads several
+// streams concurrently (fragment readahead) and pushes projections down to the decoders.
+class StreamDataset : public arrow::dataset::Dataset {
+private:
+  arrow::dataset::FragmentVector fragments_;
+
+public:
+  StreamDataset(std::shared_ptr<Schema> schema, arrow::dataset::FragmentVector fragments)
+      : Dataset(std::move(schema)), fragments_(std::move(fragments)) {}
+
+  // @param uris Stream URLs; http(s) URLs are opened with `http_open`, everything else
+  //        through Arrow's filesystems
+  // @param schema The dataset schema, or null to use the schema of the first stream
+  static Result<std::shared_ptr<StreamDataset>> Make(const std::vector<std::string>& uris,
+                                                     std::shared_ptr<Schema> schema,
+                                                     StreamOpener http_open, int64_t block_size,
+                                                     int readahead) {
+    if (uris.empty()) {
+      return Status::Invalid("A stream dataset needs at least one URL");
+    }
+    if (block_size <= 0 || readahead <= 0) {
+      return Status::Invalid("block_size and readahead must be positive");
+    }
+    arrow::dataset::FragmentVector fragments;
+    for (const auto& uri : uris) {
+      auto is_http = uri.rfind("http://", 0) == 0 || uri.rfind("https://", 0) == 0;
+      if (is_http && !http_open) {
+        return Status::Invalid("No opener for http(s) URL ", uri);
+      }
+      // Streams are assumed to share the dataset schema unless it has to be discovered
+      fragments.push_back(std::make_shared<StreamFragment>(
+          uri, schema, is_http ? http_open : StreamOpener(OpenUri), block_size, readahead));
+    }
+    if (!schema) {
+      ARROW_ASSIGN_OR_RAISE(schema, fragments[0]->ReadPhysicalSchema());
+    }
+    return std::make_shared<StreamDataset>(std::move(schema), std::move(fragments));
+  }
+
+  std::string type_name() const override { return "arrow_stream"; }
+
+  Result<std::shared_ptr<arrow::dataset::Dataset>> ReplaceSchema(
+      std::shared_ptr<Schema> schema) const override {
+    return std::make_shared<StreamDataset>(std::move(schema), fragments_);
+  }
+
+  // Scan with projection and filter pushdown
+  // @param columns Names of columns to read, when there is no projection
+  // @param projection Serialized Substrait named expressions, or empty
+  // @param filter Serialized Substrait filter expression, or empty
+  // @param use_threads Whether to decode and filter on Arrow's CPU pool
+  // @param fragment_readahead Number of streams read concurrently
+  // @return Reader over the scan's batches; reading it drives the scan
+  Result<std::shared_ptr<RecordBatchReader>> Scan(const std::vector<std::string>& columns,
+                                                  const Buffer& projection, const Buffer& filter,
+                                                  bool use_threads, int fragment_readahead) {
+    ARROW_ASSIGN_OR_RAISE(auto builder, NewScan());
+    if (projection.size() > 0) {
+      ARROW_ASSIGN_OR_RAISE(auto projected, DeserializeExpressions(projection));
+      std::vector<arrow::compute::Expression> expressions;
+      std::vector<std::string> names;
+      for (auto& [name, expression] : projected) {
+        names.push_back(name);
+        expressions.push_back(expression);
+      }
+      ARROW_RETURN_NOT_OK(builder->Project(std::move(expressions), std::move(names)));
+    } else if (!columns.empty()) {
+      ARROW_RETURN_NOT_OK(builder->Project(columns));
+    }
+    if (filter.size() > 0) {
+      ARROW_ASSIGN_OR_RAISE(auto filters, DeserializeExpressions(filter));
+      if (filters.size() != 1) {
+        return Status::Invalid("Expected a single filter expression");
+      }
+      ARROW_RETURN_NOT_OK(builder->Filter(filters[0].second));
+    }
+    ARROW_RETURN_NOT_OK(builder->UseThreads(use_threads));
+    ARROW_RETURN_NOT_OK(builder->FragmentReadahead(fragment_readahead));
+    ARROW_ASSIGN_OR_RAISE(auto scanner, builder->Finish());
+    return scanner->ToRecordBatchReader();
+  }
+
+protected:
+  Result<arrow::dataset::FragmentIterator> GetFragmentsImpl(arrow::compute::Expression) override {
+    return MakeVectorIterator(fragments_);
+  }
+};
+
+// Codec for IPC buffer compression, which supports "lz4" (LZ4 frame) and "zstd"
+// @throws std::invalid_argument for other codecs or ones this Arrow build lacks
+std::shared_ptr<arrow::util::Codec> IpcCodec(const std::string& name) {
+  auto type = arrow::util::Codec::GetCompressionType(name);
+  if (!type.ok() || (*type != arrow::Compression::LZ4_FRAME && *type != arrow::Compression::ZSTD)) {
+    throw std::invalid_argument("IPC compression must be lz4 or zstd, got " + name);
+  }
+  auto codec = arrow::util::Codec::Create(*type);
+  if (!codec.ok()) {
+    throw std::invalid_argument(codec.status().ToString());
+  }
+  return std::move(codec).ValueUnsafe();
+}
+
+// Overflow queue that spills record batches to temporary Arrow IPC files.
+// Push() hands a batch to a writer thread and returns immediately; Pop() returns spilled
+// batches in order, reading them back through a memory map, so uncompressed batches are not
+// copied again. Batches are written to segment files that are sealed when they reach
+// `segment_bytes` or when the consumer catches up with the writer; each segment is deleted
+// once it has been read.
+class SpillQueue {
+private:
+  struct Segment {
+    std::string path;
+    int64_t batches = 0;
+  };
+
+  std::string prefix_;
+  arrow::ipc::IpcWriteOptions write_options_ = arrow::ipc::IpcWriteOptions::Defaults();
+  int64_t segment_bytes_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::shared_ptr<RecordBatch>> pending_;  // pushed but not yet written
+  Segment active_;                                    // segment being written
+  std::deque<Segment> sealed_;                        // written and ready to read
+  bool seal_requested_ = false;
+  bool stop_ = false;
+  Status status_;
+  std::thread writer_thread_;
+
+  // Owned by the writer thread
+  std::shared_ptr<arrow::io::FileOutputStream> file_;
+  std::shared_ptr<arrow::ipc::RecordBatchWriter> writer_;
+  int64_t next_segment_ = 0;
+
+  // Owned by the consumer
+  std::shared_ptr<arrow::ipc::RecordBatchStreamReader> reader_;
+  std::string reading_path_;
+  int64_t unread_ = 0;
+
+public:
+  // @param directory Directory for the spill files
+  // @param compression "" for none, or "lz4" / "zstd" to compress the files' buffers
+  // @param segment_bytes Size at which a spill file is sealed and a new one started
+  // @throws std::invalid_argument if the compression is not available
+  SpillQueue(const std::string& directory, const std::string& compression, int64_t segment_bytes)
+      : segment_bytes_(segment_bytes) {
+    static std::atomic<int64_t> instances{0};
+    prefix_ = directory + "/prototype-spill-" + std::to_string(::getpid()) + "-" +
+              std::to_string(instances++) + "-";
+    if (!compression.empty()) {
+      write_options_.codec = IpcCodec(compression);
+    }
+    writer_thread_ = std::thread([this]() { Run(); });
+  }
+
+  ~SpillQueue() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    writer_thread_.join();
+    reader_.reset();
+    if (writer_) {
+      (void)writer_->Close();
+      (void)file_->Close();
+    }
+    std::error_code ignored;
+    std::filesystem::remove(reading_path_, ignored);
+    std::filesystem::remove(active_.path, ignored);
+    for (const auto& segment : sealed_) {
+      std::filesystem::remove(segment.path, ignored);
+    }
+  }
+
+  // Queue a batch for the writer thread
+  // @throws std::runtime_error if a previous write failed
+  void Push(std::shared_ptr<RecordBatch> batch) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!status_.ok()) {
+        throw std::runtime_error(status_.ToString());
+      }
+      pending_.push_back(std::move(batch));
+    }
+    cv_.notify_all();
+  }
+
+  // Return the oldest spilled batch, waiting for it to be written if necessary
+  // @throws std::runtime_error if nothing is queued or the spill files cannot be written or read
+  std::shared_ptr<RecordBatch> Pop() {
+    while (unread_ == 0) {
+      auto status = NextSegment();
+      if (!status.ok()) {
+        throw std::runtime_error(status.ToString());
+      }
+    }
+    auto batch = reader_->Next();
+    if (!batch.ok()) {
+      throw std::runtime_error(batch.status().ToString());
+    }
+    if (!*batch) {
+      throw std::runtime_error("Spill file ended early");
+    }
+    unread_--;
+    return *batch;
+  }
+
+private:
+  // Delete the segment that has been read and open the next one, sealing the segment being
+  // written if the consumer has caught up with it
+  Status NextSegment() {
+    if (reader_) {
+      reader_.reset();
+      std::error_code ignored;
+      std::filesystem::remove(reading_path_, ignored);
+      reading_path_.clear();
+    }
+    Segment segment;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (sealed_.empty()) {
+        if (pending_.empty() && active_.batches == 0) {
+          return status_.ok() ? Status::Invalid("No spilled batches") : status_;
+        }
+        seal_requested_ = true;
+        cv_.notify_all();
+        cv_.wait(lock, [&] { return !sealed_.empty() || !status_.ok(); });
+        if (sealed_.empty()) {
+          return status_;
+        }
+      }
+      segment = std::move(sealed_.front());
+      sealed_.pop_front();
+    }
+    reading_path_ = segment.path;
+    ARROW_ASSIGN_OR_RAISE(auto file, arrow::io::MemoryMappedFile::Open(segment.path,
+                                                                       arrow::io::FileMode::READ));
+    ARROW_ASSIGN_OR_RAISE(reader_, arrow::ipc::RecordBatchStreamReader::Open(file));
+    unread_ = segment.batches;
+    return Status::OK();
+  }
+
+  void Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+      if (seal_requested_ && active_.batches > 0) {
+        auto segment = std::move(active_);
+        active_ = Segment{};
+        seal_requested_ = false;
+        lock.unlock();
+        auto status = CloseSegment();
+        lock.lock();
+        if (!status.ok()) {
+          status_ = status;
+          break;
+        }
+        sealed_.push_back(std::move(segment));
+        cv_.notify_all();
+      } else if (!pending_.empty()) {
+        auto batch = pending_.front();
+        lock.unlock();
+        auto size = Write(*batch);
+        lock.lock();
+        pending_.pop_front();
+        if (!size.ok()) {
+          status_ = size.status();
+          break;
+        }
+        active_.batches++;
+        if (*size >= segment_bytes_) {
+          seal_requested_ = true;
+        }
+      } else {
+        cv_.wait(lock);
+      }
+    }
+    cv_.notify_all();
+  }
+
+  // Append a batch to the segment being written, starting one if needed
+  // @return Size of the segment so far
+  Result<int64_t> Write(const RecordBatch& batch) {
+    if (!writer_) {
+      active_.path = prefix_ + std::to_string(next_segment_++) + ".arrows";
+      ARROW_ASSIGN_OR_RAISE(file_, arrow::io::FileOutputStream::Open(active_.path));
+      ARROW_ASSIGN_OR_RAISE(writer_,
+                            arrow::ipc::MakeStreamWriter(file_, batch.schema(), write_options_));
+    }
+    ARROW_RETURN_NOT_OK(writer_->WriteRecordBatch(batch));
+    return file_->Tell();
+  }
+
+  Status CloseSegment() {
+    ARROW_RETURN_NOT_OK(writer_->Close());
+    ARROW_RETURN_NOT_OK(file_->Close());
+    writer_.reset();
+    file_.reset();
+    return Status::OK();
+  }
+};
+
+// Queue that keeps batches in memory as compressed Arrow IPC streams.
+// Push() returns immediately and a worker thread compresses queued batches in order; Pop()
+// decompresses the oldest one. A batch that reaches the front before the worker got to it is
+// returned as is, so the consumer never waits for compression.
+class CompressedBatchQueue {
+private:
+  struct Entry {
+    std::shared_ptr<RecordBatch> batch;   // released once compressed
+    std::shared_ptr<Buffer> compressed;
+    bool popped = false;
+  };
+
+  arrow::ipc::IpcWriteOptions write_options_ = arrow::ipc::IpcWriteOptions::Defaults();
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::shared_ptr<Entry>> entries_;  // in delivery order
+  std::deque<std::shared_ptr<Entry>> work_;     // waiting for the worker
+  int64_t compressed_bytes_ = 0;
+  bool stop_ = false;
+  std::thread worker_;
+
+public:
+  // @param compression "lz4" or "zstd"
+  // @throws std::invalid_argument if the compression is not available
+  explicit CompressedBatchQueue(const std::string& compression) {
+    write_options_.codec = IpcCodec(compression);
+    worker_ = std::thread([this]() { Run(); });
+  }
+
+  ~CompressedBatchQueue() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    worker_.join();
+  }
+
+  void Push(std::shared_ptr<RecordBatch> batch) {
+    auto entry = std::make_shared<Entry>();
+    entry->batch = std::move(batch);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      entries_.push_back(entry);
+      work_.push_back(std::move(entry));
+    }
+    cv_.notify_one();
+  }
+
+  // Remove the oldest batch, decompressing it if needed
+  // @throws std::runtime_error if the queue is empty or the batch cannot be decompressed
+  std::shared_ptr<RecordBatch> Pop() {
+    std::shared_ptr<Entry> entry;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (entries_.empty()) {
+        throw std::runtime_error("CompressedBatchQueue is empty");
+      }
+      entry = std::move(entries_.front());
+      entries_.pop_front();
+      entry->popped = true;
+      if (!entry->compressed) {
+        return std::move(entry->batch);
+      }
+      compressed_bytes_ -= entry->compressed->size();
+    }
+    auto batch = Decompress(entry->compressed);
+    if (!batch.ok()) {
+      throw std::runtime_error(batch.status().ToString());
+    }
+    return *batch;
+  }
+
+  // Total size of the compressed batches currently queued
+  int64_t CompressedBytes() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return compressed_bytes_;
+  }
+
+private:
+  void Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      cv_.wait(lock, [&] { return stop_ || !work_.empty(); });
+      if (stop_) {
+        return;
+      }
+      auto entry = std::move(work_.front());
+      work_.pop_front();
+      if (entry->popped) {
+        continue;
+      }
+      auto batch = entry->batch;
+      lock.unlock();
+      auto compressed = Compress(*batch);
+      batch.reset();
+      lock.lock();
+      // On failure the batch simply stays uncompressed
+      if (compressed.ok() && !entry->popped) {
+        entry->compressed = std::move(compressed).ValueUnsafe();
+        entry->batch.reset();
+        compressed_bytes_ += entry->compressed->size();
+      }
+    }
+  }
+
+  // Each batch is a complete IPC stream, so dictionaries travel with it
+  Result<std::shared_ptr<Buffer>> Compress(const RecordBatch& batch) {
+    ARROW_ASSIGN_OR_RAISE(auto sink, arrow::io::BufferOutputStream::Create());
+    ARROW_ASSIGN_OR_RAISE(auto writer,
+                          arrow::ipc::MakeStreamWriter(sink, batch.schema(), write_options_));
+    ARROW_RETURN_NOT_OK(writer->WriteRecordBatch(batch));
+    ARROW_RETURN_NOT_OK(writer->Close());
+    return sink->Finish();
+  }
+
+  static Result<std::shared_ptr<RecordBatch>> Decompress(std::shared_ptr<Buffer> buffer) {
+    auto input = std::make_shared<arrow::io::BufferReader>(std::move(buffer));
+    ARROW_ASSIGN_OR_RAISE(auto reader, arrow::ipc::RecordBatchStreamReader::Open(input));
+    ARROW_ASSIGN_OR_RAISE(auto batch, reader->Next());
+    if (!batch) {
+      return Status::Invalid("Compressed stream has no batch");
+    }
+    return batch;
+  }
+};
+
+// Byte ranges of encoded IPC messages, in order. Large ranges are the Arrow buffers
+// themselves, which the list keeps alive, so message bodies are sent without being copied;
+// ranges below kCoalesceBelow (message prefixes, metadata, padding, small bodies) are copied
+// together into one buffer, so that they do not each cost a separate write.
+class ScatterList {
+private:
+  static constexpr int64_t kCoalesceBelow = 8 * 1024;
+  std::vector<std::shared_ptr<Buffer>> pieces_;
+  std::string small_;
+
+public:
+  void Append(std::shared_ptr<Buffer> buffer) {
+    if (!buffer || buffer->size() == 0) {
+      return;
+    }
+    if (buffer->size() < kCoalesceBelow) {
+      small_.append(reinterpret_cast<const char*>(buffer->data()),
+                    static_cast<size_t>(buffer->size()));
+      return;
+    }
+    FlushSmall();
+    pieces_.push_back(std::move(buffer));
+  }
+
+  void Append(const std::string& bytes) { small_ += bytes; }
+
+  // @return The ranges appended since the last call
+  std::vector<std::shared_ptr<Buffer>> Take() {
+    FlushSmall();
+    return std::move(pieces_);
+  }
+
+private:
+  void FlushSmall() {
+    if (!small_.empty()) {
+      pieces_.push_back(Buffer::FromString(std::move(small_)));
+      small_.clear();
+    }
+  }
+};
+
+// IPC payload sink that lays out encapsulated messages (continuation marker, metadata length,
+// padded flatbuffer, then the body buffers with their padding) in a ScatterList instead of
+// copying them into an output stream. The bytes match those of MakeStreamWriter.
+class ScatterPayloadWriter : public arrow::ipc::internal::IpcPayloadWriter {
+private:
+  ScatterList* out_;
+
+  static std::string Prefix(int32_t metadata_length) {
+    std::string prefix(8, '\0');
+    auto marker = arrow::bit_util::ToLittleEndian(static_cast<int32_t>(-1));
+    auto length = arrow::bit_util::ToLittleEndian(metadata_length);
+    std::memcpy(prefix.data(), &marker, 4);
+    std::memcpy(prefix.data() + 4, &length, 4);
+    return prefix;
+  }
+
+public:
+  explicit ScatterPayloadWriter(ScatterList* out) : out_(out) {}
+
+  Status WritePayload(const arrow::ipc::IpcPayload& payload) override {
+    auto flatbuffer_size = payload.metadata->size();
+    // The 8-byte prefix plus the flatbuffer are padded to a multiple of 8
+    auto padded = arrow::bit_util::RoundUpToMultipleOf8(flatbuffer_size + 8) - 8;
+    if (padded > std::numeric_limits<int32_t>::max()) {
+      return Status::Invalid("IPC message metadata too large");
+    }
+    out_->Append(Prefix(static_cast<int32_t>(padded)));
+    out_->Append(payload.metadata);
+    out_->Append(std::string(padded - flatbuffer_size, '\0'));
+    int64_t body_length = 0;
+    for (const auto& buffer : payload.body_buffers) {
+      auto size = buffer ? buffer->size() : 0;
+      auto padding = arrow::bit_util::RoundUpToMultipleOf8(size) - size;
+      out_->Append(buffer);
+      out_->Append(std::string(padding, '\0'));
+      body_length += size + padding;
+    }
+    if (body_length != payload.body_length) {
+      return Status::Invalid("IPC body length mismatch: ", body_length, " != ", payload.body_length);
+    }
+    return Status::OK();
+  }
+
+  // End-of-stream marker
+  Status Close() override {
+    out_->Append(Prefix(0));
+    return Status::OK();
+  }
+};
+
+// Encodes record batches as an Arrow IPC stream on a background thread, so encoding (and
+// compression) overlaps with sending the previous batches. Push() queues a batch and returns
+// immediately; Pop() blocks until the next encoded chunk is ready. The first chunk starts with
+// the schema message, each chunk holds the dictionary and record batch messages of one batch,
+// and after Close() the last chunk is the end-of-stream marker. A chunk is a ScatterList of
+// buffers whose large entries are the batch's own (or, compressed, the codec's output)
+// buffers, so a caller can write them out without an intermediate serialization buffer.
+class IpcStreamEncoder {
+private:
+  std::shared_ptr<Schema> schema_;
+  arrow::ipc::IpcWriteOptions write_options_ = arrow::ipc::IpcWriteOptions::Defaults();
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::shared_ptr<RecordBatch>> input_;
+  std::deque<std::vector<std::shared_ptr<Buffer>>> output_;
+  Status status_;
+  bool closed_ = false;    // no more input
+  bool finished_ = false;  // the end-of-stream marker has been queued, or encoding failed
+  bool stop_ = false;
+  std::thread worker_;
+
+public:
+  // @param schema Schema of every batch
+  // @param compression "", "lz4" or "zstd"
+  // @throws std::invalid_argument if the compression is not available
+  IpcStreamEncoder(std::shared_ptr<Schema> schema, const std::string& compression)
+      : schema_(std::move(schema)) {
+    if (!compression.empty()) {
+      write_options_.codec = IpcCodec(compression);
+    }
+    worker_ = std::thread([this]() { Run(); });
+  }
+
+  ~IpcStreamEncoder() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    worker_.join();
+  }
+
+  // @throws std::runtime_error if the encoder was closed
+  void Push(std::shared_ptr<RecordBatch> batch) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (closed_) {
+        throw std::runtime_error("IpcStreamEncoder is closed");
+      }
+      input_.push_back(std::move(batch));
+    }
+    cv_.notify_all();
+  }
+
+  // End the stream once the queued batches are encoded
+  void Close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+    cv_.notify_all();
+  }
+
+  // Wait for the next encoded chunk
+  // @return The chunk's buffers, or none once the end-of-stream marker has been returned
+  // @throws std::runtime_error if encoding failed
+  std::vector<std::shared_ptr<Buffer>> Pop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [&] { return !output_.empty() || finished_; });
+    if (!output_.empty()) {
+      auto chunk = std::move(output_.front());
+      output_.pop_front();
+      return chunk;
+    }
+    if (!status_.ok()) {
+      throw std::runtime_error(status_.ToString());
+    }
+    return {};
+  }
+
+private:
+  void Run() {
+    auto status = Encode();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      status_ = std::move(status);
+      finished_ = true;
+    }
+    cv_.notify_all();
+  }
+
+  Status Encode() {
+    ScatterList pieces;
+    ARROW_ASSIGN_OR_RAISE(auto writer,
+                          arrow::ipc::internal::OpenRecordBatchWriter(
+                              std::make_unique<ScatterPayloadWriter>(&pieces), schema_,
+                              write_options_));
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      cv_.wait(lock, [&] { return stop_ || closed_ || !input_.empty(); });
+      if (stop_) {
+        return Status::Cancelled("IpcStreamEncoder destroyed");
+      }
+      if (input_.empty()) {
+        lock.unlock();
+        ARROW_RETURN_NOT_OK(writer->Close());
+        Flush(&pieces);
+        return Status::OK();
+      }
+      auto batch = std::move(input_.front());
+      input_.pop_front();
+      lock.unlock();
+      if (!batch->schema()->Equals(*schema_, /*check_metadata=*/false)) {
+        return Status::Invalid("Batch schema does not match the stream schema");
+      }
+      ARROW_RETURN_NOT_OK(writer->WriteRecordBatch(*batch));
+      batch.reset();
+      Flush(&pieces);
+      lock.lock();
+    }
+  }
+
+  // Move what the writer has laid out so far to the output queue
+  void Flush(ScatterList* pieces) {
+    auto chunk = pieces->Take();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      output_.push_back(std::move(chunk));
+    }
+    cv_.notify_all();
+  }
+};
+
+// Expose a mutable Arrow buffer to Python as a writable buffer-protocol object.
+// The capsule keeps the Arrow buffer alive for as long as Python holds the view.
+nb::ndarray<uint8_t, nb::ndim<1>, nb::c_contig> WritableView(std::shared_ptr<Buffer> buffer) {
+  auto* data = buffer->mutable_data();
+  auto size = static_cast<size_t>(buffer->size());
+  nb::capsule owner(new std::shared_ptr<Buffer>(std::move(buffer)), [](void* p) noexcept {
+    delete static_cast<std::shared_ptr<Buffer>*>(p);
+  });
+  return nb::ndarray<uint8_t, nb::ndim<1>, nb::c_contig>(data, {size}, owner);
+}
+
+// Expose an immutable Arrow buffer to Python as a read-only buffer-protocol object, without
+// copying. The capsule keeps the Arrow buffer alive for as long as Python holds the view.
+nb::ndarray<const uint8_t, nb::ndim<1>, nb::c_contig> ReadOnlyView(std::shared_ptr<Buffer> buffer) {
+  const auto* data = buffer->data();
+  auto size = static_cast<size_t>(buffer->size());
+  nb::capsule owner(new std::shared_ptr<Buffer>(std::move(buffer)), [](void* p) noexcept {
+    delete static_cast<std::shared_ptr<Buffer>*>(p);
+  });
+  return nb::ndarray<const uint8_t, nb::ndim<1>, nb::c_contig>(data, {size}, owner);
+}
+
+// Spin-wait hint for busy loops
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread
+template <typename T>
+class SpscQueue {
+private:
+  std::vector<T> slots_;
+  size_t mask_;
+  alignas(64) std::atomic<size_t> head_{0};  // next slot to pop; advanced by the consumer
+  alignas(64) std::atomic<size_t> tail_{0};  // next slot to push; advanced by the producer
+
+public:
+  // @param capacity Maximum number of queued values, rounded up to a power of two
+  explicit SpscQueue(size_t capacity)
+      : slots_(static_cast<size_t>(arrow::bit_util::NextPower2(std::max<int64_t>(capacity, 2)))),
+        mask_(slots_.size() - 1) {}
+
+  // @return false, leaving `value` untouched, if the queue is full
+  bool TryPush(T&& value) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == slots_.size()) {
+      return false;
+    }
+    slots_[tail & mask_] = std::move(value);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Number of queued values; only a snapshot while the other thread is active
+  size_t Size() const {
+    return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+  }
+
+  // @return false if the queue is empty
+  bool TryPop(T* value) {
+    auto head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    *value = std::move(slots_[head & mask_]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+};
+
+// Low-latency reader of an Arrow IPC stream from a connected socket. Instead of sleeping in
+// poll(), a dedicated thread, optionally pinned to a core, spins on non-blocking reads (with
+// SO_BUSY_POLL where permitted, so the socket's device queue is polled as well), decodes each
+// read immediately and publishes every batch to a lock-free queue that Pop() spins on.
+// There is no wakeup anywhere between the socket and the consumer, at the cost of a fully
+// busy core for the reader and another for a waiting consumer.
+class BusyPollSource {
+private:
+  // Minimum read size, so that small messages are not read one syscall per prefix
+  static constexpr int64_t kMinRead = 64 * 1024;
+  // How often a waiting Pop() runs its interrupt check, in spins and at most in time
+  static constexpr uint64_t kInterruptCheckSpins = 1024;
+  static constexpr int64_t kInterruptCheckNs = 50'000'000;
+
+  struct Entry {
+    std::shared_ptr<RecordBatch> batch;
+    int64_t arrival_ns = 0;
+  };
+
+  // Publishes decoded batches, stamped with the time their last bytes were read
+  class QueueSink : public BatchSink {
+  private:
+    BusyPollSource* source_;
+
+  public:
+    explicit QueueSink(BusyPollSource* source) : source_(source) {}
+
+    Status OnSchema(const std::shared_ptr<Schema>& schema) override { return Status::OK(); }
+
+    Status OnBatch(const std::shared_ptr<RecordBatch>& batch) override {
+      Entry entry{batch, source_->arrival_ns_};
+      // A full queue holds the reader back until the consumer catches up
+      while (!source_->queue_.TryPush(std::move(entry))) {
+        if (source_->stop_.load(std::memory_order_relaxed)) {
+          return Status::Cancelled("BusyPollSource closed");
+        }
+        CpuRelax();
+      }
+      PROTOTYPE_PROBE(queue_enqueue, source_->listener_->stream_id(), source_->queue_.Size(),
+                      arrow::util::TotalBufferSize(*batch), MonotonicNanos());
+      return Status::OK();
+    }
+
+    void OnFinish(const Status& status) override {}
+  };
+
+  int fd_;
+  int cpu_;
+  int busy_poll_usec_;
+  SpscQueue<Entry> queue_;
+  std::shared_ptr<Listener> listener_;
+  std::unique_ptr<ProjectedDecoder> decoder_;
+  int64_t arrival_ns_ = 0;           // owned by the reader thread
+  std::atomic<bool> stop_{false};
+  std::atomic<bool> finished_{false};
+  Status status_;                    // published by finished_
+  std::thread reader_thread_;
+
+public:
+  // @param fd Connected socket to read; it is duplicated, so the caller keeps ownership of `fd`.
+  //     The duplicate shares the file status flags, so a blocking socket is non-blocking for
+  //     the caller too until the reader stops, when the flags are restored
+  // @param cpu Core to pin the reader thread to, or -1 to leave it unpinned
+  // @param busy_poll_usec SO_BUSY_POLL time per read; 0 to leave the socket option alone
+  // @param capacity Maximum number of decoded batches waiting for the consumer
+  // @throws std::runtime_error if the socket cannot be duplicated
+  BusyPollSource(int fd, int cpu, int busy_poll_usec, size_t capacity)
+      : fd_(dup(fd)), cpu_(cpu), busy_poll_usec_(busy_poll_usec), queue_(capacity) {
+    if (fd_ < 0) {
+      throw std::runtime_error(arrow::internal::IOErrorFromErrno(errno, "dup failed").ToString());
+    }
+    listener_ = std::make_shared<Listener>();
+    listener_->SetSink(std::make_shared<QueueSink>(this));
+    decoder_ = std::make_unique<ProjectedDecoder>(listener_);
+    reader_thread_ = std::thread([this]() {
+      status_ = Run();
+      finished_.store(true, std::memory_order_release);
+    });
+  }
+
+  ~BusyPollSource() {
+    Close();
+    reader_thread_.join();
+    close(fd_);
+  }
+
+  // Stop reading; a consumer spinning in Pop() gets an error unless the stream already ended
+  void Close() { stop_.store(true, std::memory_order_relaxed); }
+
+  // Wait for the next batch by spinning, without ever sleeping
+  // @param arrival_ns Set to the CLOCK_MONOTONIC time at which the batch's last bytes were read
+  // @param check_interrupt Called about every 50 ms while waiting; may throw to stop waiting
+  // @return The batch, or nullptr once the stream has ended
+  // @throws std::runtime_error if reading or decoding failed or the source was closed
+  std::shared_ptr<RecordBatch> Pop(int64_t* arrival_ns,
+                                   const std::function<void()>& check_interrupt = nullptr) {
+    Entry entry;
+    uint64_t spins = 0;
+    int64_t next_check_ns = check_interrupt ? MonotonicNanos() + kInterruptCheckNs : 0;
+    while (!queue_.TryPop(&entry)) {
+      if (finished_.load(std::memory_order_acquire)) {
+        // The last batches may have been published just before the end
+        if (queue_.TryPop(&entry)) {
+          break;
+        }
+        if (!status_.ok()) {
+          throw std::runtime_error(status_.ToString());
+        }
+        return nullptr;
+      }
+      if (check_interrupt && ++spins % kInterruptCheckSpins == 0 &&
+          MonotonicNanos() >= next_check_ns) {
+        check_interrupt();
+        next_check_ns = MonotonicNanos() + kInterruptCheckNs;
+      }
+      CpuRelax();
+    }
+    PROTOTYPE_PROBE(queue_dequeue, listener_->stream_id(), queue_.Size(),
+                    arrow::util::TotalBufferSize(*entry.batch), MonotonicNanos());
+    *arrival_ns = entry.arrival_ns;
+    return std::move(entry.batch);
+  }
+
+private:
+  Status Run() {
+    if (cpu_ >= 0) {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(cpu_, &cpus);
+      auto error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+      if (error != 0) {
+        return arrow::internal::IOErrorFromErrno(error, "Cannot pin the reader to CPU ", cpu_);
+      }
+    }
+#ifdef SO_BUSY_POLL
+    if (busy_poll_usec_ > 0) {
+      // Best effort: values above net.core.busy_read need CAP_NET_ADMIN
+      setsockopt(fd_, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_usec_, sizeof(busy_poll_usec_));
+    }
+#endif
+    auto flags = fcntl(fd_, F_GETFL);
+    if (flags < 0 || fcntl(fd_, F_SETFL, flags | O_NONBLOCK) < 0) {
+      return arrow::internal::IOErrorFromErrno(errno, "Cannot make the socket non-blocking");
+    }
+    auto status = ReadLoop();
+    // O_NONBLOCK belongs to the open file description, which the caller's socket shares
+    if (!(flags & O_NONBLOCK)) {
+      fcntl(fd_, F_SETFL, flags);
+    }
+    return status;
+  }
+
+  Status ReadLoop() {
+    std::shared_ptr<ResizableBuffer> buffer;
+    while (!stop_.load(std::memory_order_relaxed)) {
+      if (!buffer) {
+        ARROW_ASSIGN_OR_RAISE(buffer, arrow::AllocateResizableBuffer(
+                                          std::max(decoder_->next_required_size(), kMinRead)));
+      }
+      auto n = read(fd_, buffer->mutable_data(), static_cast<size_t>(buffer->size()));
+      if (n > 0) {
+        arrival_ns_ = MonotonicNanos();
+        // As in StreamDecoderWrapper::CommitBuffer, the decoder takes over the buffer
+        std::shared_ptr<Buffer> block = std::move(buffer);
+        ARROW_RETURN_NOT_OK(decoder_->Consume(arrow::SliceBuffer(block, 0, n)));
+      } else if (n == 0) {
+        return Status::OK();
+      } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        CpuRelax();
+      } else if (errno != EINTR) {
+        return arrow::internal::IOErrorFromErrno(errno, "Socket read failed");
+      }
+    }
+    return Status::Cancelled("BusyPollSource closed");
+  }
+};
+
+// Arrow buffer over the memory of a Python bytes object, which it keeps alive. The reference
+// is dropped under the GIL, from whichever thread releases the buffer last.
+class PyBytesBuffer : public Buffer {
+private:
+  nb::bytes bytes_;
+
+public:
+  explicit PyBytesBuffer(nb::bytes bytes)
+      : Buffer(static_cast<const uint8_t*>(bytes.data()), static_cast<int64_t>(bytes.size())),
+        bytes_(std::move(bytes)) {}
+
+  ~PyBytesBuffer() override {
+    if (nb::is_alive()) {
+      nb::gil_scoped_acquire gil;
+      bytes_.reset();
+    } else {
+      bytes_.release();
+    }
+  }
+};
+
+// Import the first batch of a Python object implementing the Arrow PyCapsule stream
+// interface (__arrow_c_stream__), such as a pyarrow Table or RecordBatchReader
+std::shared_ptr<RecordBatch> ImportFirstBatch(nb::handle obj) {
+  auto capsule = nb::cast<nb::capsule>(obj.attr("__arrow_c_stream__")());
+  auto reader = arrow::ImportRecordBatchReader(static_cast<ArrowArrayStream*>(capsule.data()));
+  if (!reader.ok()) {
+    throw std::runtime_error(reader.status().ToString());
+  }
+  auto batch = (*reader)->Next();
+  if (!batch.ok()) {
+    throw std::runtime_error(batch.status().ToString());
+  }
+  if (!*batch) {
+    throw std::invalid_argument("Expected a stream with at least one batch");
+  }
+  return *batch;
+}
+
+// Adapt a Python callable returning bytes for use as a callback from Arrow threads.
+// nanobind's std::string caster only accepts str, so the result is converted here. The GIL
+// is held for the call and whenever the last copy of the returned function is dropped.
+template <typename... Args>
+std::function<std::string(Args...)> BytesFunction(nb::callable fn) {
+  std::shared_ptr<nb::callable> holder(new nb::callable(std::move(fn)), [](nb::callable* p) {
+    nb::gil_scoped_acquire gil;
+    delete p;
+  });
+  return [holder](Args... args) {
+    nb::gil_scoped_acquire gil;
+    try {
+      auto data = nb::cast<nb::bytes>((*holder)(args...));
+      return std::string(data.c_str(), data.size());
+    } catch (const nb::python_error& e) {
+      throw std::runtime_error(e.what());
+    }
+  };
+}
+
+// StreamOpener backed by a Python callable that maps a URL to a read(nbytes) -> bytes function.
+// If that function has a close() method, it is called when the stream is closed or dropped.
+StreamOpener PythonOpener(nb::callable open) {
+  std::shared_ptr<nb::callable> holder(new nb::callable(std::move(open)), [](nb::callable* p) {
+    nb::gil_scoped_acquire gil;
+    delete p;
+  });
+  return [holder](const std::string& uri) -> Result<std::shared_ptr<arrow::io::InputStream>> {
+    nb::gil_scoped_acquire gil;
+    try {
+      auto read = nb::cast<nb::callable>((*holder)(uri));
+      std::function<void()> close;
+      auto close_method = nb::getattr(read, "close", nb::none());
+      if (!close_method.is_none()) {
+        auto method = std::shared_ptr<nb::object>(
+            new nb::object(std::move(close_method)), [](nb::object* p) {
+              nb::gil_scoped_acquire gil;
+              delete p;
+            });
+        close = [method]() {
+          nb::gil_scoped_acquire gil;
+          try {
+            (*method)();
+          } catch (const nb::python_error& e) {
+            throw std::runtime_error(e.what());
+          }
+        };
+      }
+      return std::make_shared<ReadCallbackStream>(BytesFunction<int64_t>(std::move(read)),
+                                                  std::move(close));
+    } catch (const std::exception& e) {
+      return Status::IOError("Opening ", uri, ": ", e.what());
+    }
+  };
+}
+
+// PyCapsules following the Arrow PyCapsule interface, for pa.Schema._import_from_c_capsule
+// and pa.RecordBatchReader._import_from_c_capsule. An unconsumed capsule releases its data.
+nb::capsule SchemaCapsule(const Schema& schema) {
+  auto* c_schema = new ArrowSchema{};
+  auto status = arrow::ExportSchema(schema, c_schema);
+  if (!status.ok()) {
+    delete c_schema;
+    throw std::runtime_error(status.ToString());
+  }
+  return nb::capsule(c_schema, "arrow_schema", [](void* p) noexcept {
+    auto* c_schema = static_cast<ArrowSchema*>(p);
+    if (c_schema->release) {
+      c_schema->release(c_schema);
+    }
+    delete c_schema;
+  });
+}
+
+// Import a Python object implementing __arrow_c_schema__, such as a pyarrow Schema
+std::shared_ptr<Schema> ImportSchemaObject(nb::handle obj) {
+  auto capsule = nb::cast<nb::capsule>(obj.attr("__arrow_c_schema__")());
+  auto schema = arrow::ImportSchema(static_cast<ArrowSchema*>(capsule.data()));
+  if (!schema.ok()) {
+    throw std::runtime_error(schema.status().ToString());
+  }
+  return *schema;
+}
+
+// Import a Python object implementing __arrow_c_array__, such as a pyarrow RecordBatch
+std::shared_ptr<RecordBatch> ImportBatch(nb::handle obj) {
+  auto capsules = nb::cast<nb::tuple>(obj.attr("__arrow_c_array__")());
+  auto schema = nb::cast<nb::capsule>(capsules[0]);
+  auto array = nb::cast<nb::capsule>(capsules[1]);
+  auto batch = arrow::ImportRecordBatch(static_cast<ArrowArray*>(array.data()),
+                                        static_cast<ArrowSchema*>(schema.data()));
+  if (!batch.ok()) {
+    throw std::runtime_error(batch.status().ToString());
+  }
+  return *batch;
+}
+
+// (arrow_schema, arrow_array) capsules for pa.RecordBatch._import_from_c_capsule
+nb::tuple BatchCapsules(const RecordBatch& batch) {
+  auto* array = new ArrowArray{};
+  auto status = arrow::ExportRecordBatch(batch, array);
+  if (!status.ok()) {
+    delete array;
+    throw std::runtime_error(status.ToString());
+  }
+  nb::capsule array_capsule(array, "arrow_array", [](void* p) noexcept {
+    auto* array = static_cast<ArrowArray*>(p);
+    if (array->release) {
+      array->release(array);
+    }
+    delete array;
+  });
+  return nb::make_tuple(SchemaCapsule(*batch.schema()), array_capsule);
+}
+
+nb::capsule StreamCapsule(std::shared_ptr<RecordBatchReader> reader) {
+  auto* stream = new ArrowArrayStream{};
+  auto status = arrow::ExportRecordBatchReader(std::move(reader), stream);
+  if (!status.ok()) {
+    delete stream;
+    throw std::runtime_error(status.ToString());
+  }
+  return nb::capsule(stream, "arrow_array_stream", [](void* p) noexcept {
+    auto* stream = static_cast<ArrowArrayStream*>(p);
+    if (stream->release) {
+      stream->release(stream);
+    }
+    delete stream;
+  });
+}
+
+NB_MODULE(prototype_cpp, m) {
+  m.doc() = "Module for processing Arrow streams over HTTP";
+#if ARROW_VERSION_MAJOR >= 21
+  // Compute kernels live in a separate library that must be initialized explicitly
+  auto status = arrow::compute::Initialize();
+  if (!status.ok()) {
+    throw std::runtime_error(status.ToString());
+  }
+#endif
+  // Registers the scan node used by dataset scanners
+  arrow::dataset::internal::Initialize();
+  m.def("arrow_version", &get_arrow_version,
+        "Returns the major version of Arrow");
+  m.def("has_substrait", &has_substrait,
+        "Whether expressions (filters, computed projections, Substrait plans) are supported");
+  m.def("interned_schema",
+        [](uint64_t id) {
+            try {
+                return SchemaCapsule(*SchemaCache::Instance().Get(id));
+            } catch (const std::out_of_range&) {
+                throw std::invalid_argument("Unknown schema id");
+            }
+        },
+        nb::arg("id"),
+        "Export the schema with the given id, as passed to schema and batch callbacks");
+  nb::class_<StreamDecoderWrapper>(m, "StreamDecoderWrapper")
+      .def(nb::init<int64_t>(), nb::arg("max_queued_bytes") = int64_t{16} << 20)
+      .def("set_batch_callback", &StreamDecoderWrapper::SetBatchCallback,
+           "Set the callback for processing Arrow batches")
+      .def("set_schema_callback", &StreamDecoderWrapper::SetSchemaCallback,
+          "Set the callback for receiving the Arrow schema")
+      .def("set_cast",
+           [](StreamDecoderWrapper& self, nb::handle cast_to, bool safe) {
+               self.SetCast(ImportSchemaObject(cast_to), safe);
+           },
+           nb::arg("cast_to"), nb::arg("safe") = true,
+           "Cast batches to the types of the named fields in cast_to before delivery")
+      .def("set_projection", &StreamDecoderWrapper::SetProjection,
+           nb::arg("paths"), nb::arg("flatten") = false,
+           "Keep only the given nested field paths; must be called before consuming bytes")
+      .def("set_filters",
+           [](StreamDecoderWrapper& self, const std::vector<std::string>& columns,
+              const std::vector<std::string>& ops, nb::handle values) {
+               self.SetFilters(columns, ops, ImportFirstBatch(values));
+           },
+           nb::arg("columns"), nb::arg("ops"), nb::arg("values"),
+           "Drop rows failing any predicate; values is a one-row table, one column per predicate")
+      // Bytes as input. Decoding (and casting) runs without the GIL; the Python
+      // callbacks take it back when they are invoked.
+      .def("consume_bytes", 
+           [](StreamDecoderWrapper& self, const nb::bytes& data) {
+               return self.ConsumeBytes(
+                   reinterpret_cast<const uint8_t*>(data.c_str()),
+                   data.size()
+               );
+           },
+           nb::call_guard<nb::gil_scoped_release>())
+      // Bytearray as input
+      .def("consume_bytes",
+           [](StreamDecoderWrapper& self, const nb::bytearray& data) {
+               return self.ConsumeBytes(
+                   reinterpret_cast<const uint8_t*>(data.data()),
+                   data.size()
+               );
+           },
+           nb::call_guard<nb::gil_scoped_release>())
+      .def("next_required_size", &StreamDecoderWrapper::NextRequiredSize,
+           "Number of bytes the decoder needs to make progress")
+      // Writable view over decoder-owned memory, for asyncio.BufferedProtocol.get_buffer()
+      .def("get_buffer",
+           [](StreamDecoderWrapper& self, size_t min_size) {
+               return WritableView(self.GetBuffer(min_size));
+           },
+           nb::arg("min_size") = 0,
+           "Writable tail of a buffer sized from the decoder's next required size")
+      .def("commit_buffer", &StreamDecoderWrapper::CommitBuffer,
+           nb::call_guard<nb::gil_scoped_release>(),
+           "Commit n bytes written into the buffer from get_buffer(); decodes once enough arrived")
+      .def("consume_uri", &StreamDecoderWrapper::ConsumeUri,
+           nb::arg("uri"), nb::arg("block_size"), nb::arg("readahead"), nb::arg("done_callback"),
+           nb::call_guard<nb::gil_scoped_release>(),
+           "Read a filesystem URI on Arrow's I/O thread pool and decode it in the background")
+      .def("push_frame",
+           [](StreamDecoderWrapper& self, nb::bytes frame) {
+               return self.PushBuffer(std::make_shared<PyBytesBuffer>(std::move(frame)));
+           },
+           nb::arg("frame"),
+           "Queue a bytes object for decoding on a background thread, without copying it; "
+           "returns True once max_queued_bytes wait, until the drain callback runs")
+      .def("finish_frames", &StreamDecoderWrapper::FinishBuffers,
+           nb::arg("done_callback"),
+           nb::call_guard<nb::gil_scoped_release>(),
+           "End the frames queued with push_frame; done_callback is called once they are decoded")
+      .def("finish", &StreamDecoderWrapper::Finish, nb::arg("done_callback"),
+           "Signal the end of input; done_callback is called once the last batch is delivered")
+      .def("queue_full", &StreamDecoderWrapper::QueueFull,
+           "Whether max_queued_bytes of pushed frames wait to be decoded")
+      .def("set_drain_callback", &StreamDecoderWrapper::SetDrainCallback,
+           "Set the callback run on the decoding thread once the frame queue drains after "
+           "being reported full")
+      .def("abort", &StreamDecoderWrapper::Abort, nb::arg("message"),
+           "Signal that reading the input failed")
+      .def("enable_perf_counters", &StreamDecoderWrapper::EnablePerfCounters,
+           "Count hardware events around consumed input and exported batches")
+      .def_prop_ro("stream_id", &StreamDecoderWrapper::StreamId,
+                   "Id of this stream in the USDT probes")
+      .def("perf_counters", &StreamDecoderWrapper::PerfCounterTotals,
+           "Event totals of the consume and export regions, since counters were enabled");
+
+  nb::class_<ParquetSource>(m, "ParquetSource")
+      .def(nb::init<>())
+      .def("set_batch_callback", &ParquetSource::SetBatchCallback,
+           "Set the callback for processing Arrow batches")
+      .def("set_schema_callback", &ParquetSource::SetSchemaCallback,
+           "Set the callback for receiving the Arrow schema")
+      .def("set_cast",
+           [](ParquetSource& self, nb::handle cast_to, bool safe) {
+               self.SetCast(ImportSchemaObject(cast_to), safe);
+           },
+           nb::arg("cast_to"), nb::arg("safe") = true,
+           "Cast batches to the types of the named fields in cast_to before delivery")
+      .def("set_filters",
+           [](ParquetSource& self, const std::vector<std::string>& columns,
+              const std::vector<std::string>& ops, nb::handle values) {
+               self.SetFilters(columns, ops, ImportFirstBatch(values));
+           },
+           nb::arg("columns"), nb::arg("ops"), nb::arg("values"),
+           "Set row group pruning predicates; values is a one-row table, one column per predicate")
+      .def("start",
+           [](ParquetSource& self, int64_t size, nb::callable read_range,
+              std::vector<std::string> columns, int64_t batch_size, int readahead,
+              std::function<void(const std::string&)> done_callback) {
+               auto read = BytesFunction<int64_t, int64_t>(std::move(read_range));
+               nb::gil_scoped_release release;
+               self.Start(size, std::move(read), std::move(columns), batch_size, readahead,
+                          std::move(done_callback));
+           },
+           nb::arg("size"), nb::arg("read_range"), nb::arg("columns"), nb::arg("batch_size"),
+           nb::arg("readahead"), nb::arg("done_callback"),
+           "Read the file on a background thread, fetching byte ranges with read_range")
+      .def("start_uri", &ParquetSource::StartUri,
+           nb::arg("uri"), nb::arg("columns"), nb::arg("batch_size"), nb::arg("readahead"),
+           nb::arg("done_callback"),
+           nb::call_guard<nb::gil_scoped_release>(),
+           "Read a filesystem URI on a background thread");
+
+  nb::class_<TextStreamReader>(m, "TextStreamReader")
+      .def(nb::init<const std::string&, int32_t, int64_t>(), nb::arg("format"),
+           nb::arg("block_size") = 1 << 20, nb::arg("max_queued_bytes") = int64_t{16} << 20)
+      .def("set_batch_callback", &TextStreamReader::SetBatchCallback,
+           "Set the callback for processing Arrow batches")
+      .def("set_schema_callback", &TextStreamReader::SetSchemaCallback,
+           "Set the callback for receiving the Arrow schema")
+      .def("set_cast",
+           [](TextStreamReader& self, nb::handle cast_to, bool safe) {
+               self.SetCast(ImportSchemaObject(cast_to), safe);
+           },
+           nb::arg("cast_to"), nb::arg("safe") = true,
+           "Cast batches to the types of the named fields in cast_to before delivery")
+      .def("consume_bytes",
+           [](TextStreamReader& self, const nb::bytes& data) {
+               return self.ConsumeBytes(
+                   reinterpret_cast<const uint8_t*>(data.c_str()),
+                   data.size()
+               );
+           })
+      .def("consume_bytes",
+           [](TextStreamReader& self, const nb::bytearray& data) {
+               return self.ConsumeBytes(
+                   reinterpret_cast<const uint8_t*>(data.data()),
+                   data.size()
+               );
+           })
+      .def("get_buffer",
+           [](TextStreamReader& self, size_t min_size) {
+               return WritableView(self.GetBuffer(min_size));
+           },
+           nb::arg("min_size") = 0,
+           "Allocate a writable buffer to receive bytes in place")
+      .def("commit_buffer", &TextStreamReader::CommitBuffer,
+           "Push the first n bytes written into the buffer from get_buffer()")
+      // Same signature as StreamDecoderWrapper.consume_uri; the parser does its own block
+      // sizing and readahead, so block_size and readahead are not used here.
+      .def("consume_uri",
+           [](TextStreamReader& self, const std::string& uri, int64_t, int,
+              std::function<void(const std::string&)> done_callback) {
+               self.ConsumeUri(uri, std::move(done_callback));
+           },
+           nb::arg("uri"), nb::arg("block_size"), nb::arg("readahead"), nb::arg("done_callback"),
+           nb::call_guard<nb::gil_scoped_release>(),
+           "Parse a filesystem URI on a background thread")
+      .def("finish", &TextStreamReader::Finish, nb::arg("done_callback"),
+           nb::call_guard<nb::gil_scoped_release>(),
+           "Signal the end of input; done_callback is called once the remaining batches are parsed")
+      .def("queue_full", &TextStreamReader::QueueFull,
+           "Whether more than max_queued_bytes wait for the parser; stop reading until drained")
+      .def_prop_ro("queued_bytes", &TextStreamReader::QueuedBytes,
+                   "Number of bytes waiting for the parser")
+      .def("set_drain_callback", &TextStreamReader::SetDrainCallback,
+           "Set the callback run on the parsing thread once the queue drains after queue_full()");
+
+  nb::class_<AceroPlan>(m, "AceroPlan")
+      .def(nb::init<>())
+      .def("set_batch_callback", &AceroPlan::SetBatchCallback,
+           "Set the callback for processing the plan's output batches")
+      .def("set_schema_callback", &AceroPlan::SetSchemaCallback,
+           "Set the callback for receiving the plan's output schema")
+      .def("add_input", &AceroPlan::AddInput, nb::arg("name"), nb::arg("wrapper"),
+           "Feed the batches decoded by wrapper into the plan as the named table")
+      // The serialized messages are copied while the GIL is held; the plan outlives the call
+      .def("start_declaration",
+           [](AceroPlan& self, nb::bytes filter, nb::bytes projection,
+              std::vector<std::string> columns, std::vector<std::string> group_by,
+              std::vector<std::tuple<std::string, std::string, std::string>> aggregates,
+              std::function<void(const std::string&)> done_callback) {
+               auto filter_buffer = Buffer::FromString(std::string(filter.c_str(), filter.size()));
+               auto projection_buffer =
+                   Buffer::FromString(std::string(projection.c_str(), projection.size()));
+               nb::gil_scoped_release release;
+               self.StartDeclaration(std::move(filter_buffer), std::move(projection_buffer),
+                                     std::move(columns), std::move(group_by),
+                                     std::move(aggregates), std::move(done_callback));
+           },
+           nb::arg("filter"), nb::arg("projection"), nb::arg("columns"), nb::arg("group_by"),
+           nb::arg("aggregates"), nb::arg("done_callback"),
+           "Run filter, project and aggregate steps over the single input on a background thread")
+      .def("start_substrait",
+           [](AceroPlan& self, nb::bytes plan, std::function<void(const std::string&)> done_callback) {
+               auto plan_buffer = Buffer::FromString(std::string(plan.c_str(), plan.size()));
+               nb::gil_scoped_release release;
+               self.StartSubstrait(std::move(plan_buffer), std::move(done_callback));
+           },
+           nb::arg("plan"), nb::arg("done_callback"),
+           "Run a serialized Substrait plan over the inputs on a background thread");
+
+  nb::class_<StreamDataset>(m, "StreamDataset")
+      .def_static("make",
+           [](const std::vector<std::string>& uris, nb::handle schema, nb::handle http_open,
+              int64_t block_size, int readahead) {
+               auto imported = schema.is_none() ? nullptr : ImportSchemaObject(schema);
+               StreamOpener opener;
+               if (!http_open.is_none()) {
+                   opener = PythonOpener(nb::borrow<nb::callable>(http_open));
+               }
+               nb::gil_scoped_release release;
+               auto dataset = StreamDataset::Make(uris, std::move(imported), std::move(opener),
+                                                  block_size, readahead);
+               if (!dataset.ok()) {
+                   throw std::runtime_error(dataset.status().ToString());
+               }
+               return *dataset;
+           },
+           nb::arg("uris"), nb::arg("schema").none(), nb::arg("http_open").none(),
+           nb::arg("block_size"), nb::arg("readahead"),
+           "Create a dataset with one fragment per stream URL")
+      .def("schema",
+           [](StreamDataset& self) { return SchemaCapsule(*self.schema()); },
+           "The dataset schema as an arrow_schema PyCapsule")
+      .def("scan",
+           [](StreamDataset& self, const std::vector<std::string>& columns, nb::bytes projection,
+              nb::bytes filter, bool use_threads, int fragment_readahead) {
+               auto projection_buffer = std::make_shared<Buffer>(
+                   reinterpret_cast<const uint8_t*>(projection.c_str()), projection.size());
+               auto filter_buffer = std::make_shared<Buffer>(
+                   reinterpret_cast<const uint8_t*>(filter.c_str()), filter.size());
+               Result<std::shared_ptr<RecordBatchReader>> reader;
+               {
+                   nb::gil_scoped_release release;
+                   reader = self.Scan(columns, *projection_buffer, *filter_buffer, use_threads,
+                                      fragment_readahead);
+               }
+               if (!reader.ok()) {
+                   throw std::runtime_error(reader.status().ToString());
+               }
+               return StreamCapsule(*reader);
+           },
+           nb::arg("columns"), nb::arg("projection"), nb::arg("filter"), nb::arg("use_threads"),
+           nb::arg("fragment_readahead"),
+           "Start a scan; returns an arrow_array_stream PyCapsule that drives it when read");
+
+  nb::class_<SpillQueue>(m, "SpillQueue")
+      .def(nb::init<const std::string&, const std::string&, int64_t>(),
+           nb::arg("directory"), nb::arg("compression") = "", nb::arg("segment_bytes") = 64 << 20)
+      .def("push",
+           [](SpillQueue& self, nb::handle batch) { self.Push(ImportBatch(batch)); },
+           nb::arg("batch"),
+           "Queue a batch to be written to the spill files on the writer thread")
+      .def("pop",
+           [](SpillQueue& self) {
+               std::shared_ptr<RecordBatch> batch;
+               {
+                   nb::gil_scoped_release release;
+                   batch = self.Pop();
+               }
+               return BatchCapsules(*batch);
+           },
+           "Read back the oldest spilled batch as (arrow_schema, arrow_array) capsules");
+
+  nb::class_<CompressedBatchQueue>(m, "CompressedBatchQueue")
+      .def(nb::init<const std::string&>(), nb::arg("compression") = "lz4")
+      .def("push",
+           [](CompressedBatchQueue& self, nb::handle batch) { self.Push(ImportBatch(batch)); },
+           nb::arg("batch"),
+           "Queue a batch to be compressed on the worker thread")
+      .def("pop",
+           [](CompressedBatchQueue& self) {
+               std::shared_ptr<RecordBatch> batch;
+               {
+                   nb::gil_scoped_release release;
+                   batch = self.Pop();
+               }
+               return BatchCapsules(*batch);
+           },
+           "Remove the oldest batch, decompressed, as (arrow_schema, arrow_array) capsules")
+      .def("compressed_bytes", &CompressedBatchQueue::CompressedBytes,
+           "Total size of the compressed batches currently queued");
+
+  nb::class_<IpcStreamEncoder>(m, "IpcStreamEncoder")
+      .def("__init__",
+           [](IpcStreamEncoder* self, nb::handle schema, const std::string& compression) {
+               new (self) IpcStreamEncoder(ImportSchemaObject(schema), compression);
+           },
+           nb::arg("schema"), nb::arg("compression") = "")
+      .def("push",
+           [](IpcStreamEncoder& self, nb::handle batch) { self.Push(ImportBatch(batch)); },
+           nb::arg("batch"),
+           "Queue a batch to be encoded on the worker thread")
+      .def("close", &IpcStreamEncoder::Close,
+           "End the stream once the queued batches are encoded")
+      .def("pop",
+           [](IpcStreamEncoder& self) -> nb::object {
+               std::vector<std::shared_ptr<Buffer>> chunk;
+               {
+                   nb::gil_scoped_release release;
+                   chunk = self.Pop();
+               }
+               if (chunk.empty()) {
+                   return nb::none();
+               }
+               nb::list views;
+               for (auto& buffer : chunk) {
+                   views.append(ReadOnlyView(std::move(buffer)));
+               }
+               return views;
+           },
+           "Wait for the next encoded chunk, as a list of read-only buffers over Arrow memory; "
+           "None after the end of stream");
+
+  nb::class_<BusyPollSource>(m, "BusyPollSource")
+      .def(nb::init<int, int, int, size_t>(), nb::arg("fd"), nb::arg("cpu") = -1,
+           nb::arg("busy_poll_usec") = 50, nb::arg("capacity") = 1024)
+      .def("pop",
+           [](BusyPollSource& self) -> nb::object {
+               std::shared_ptr<RecordBatch> batch;
+               int64_t arrival_ns = 0;
+               {
+                   nb::gil_scoped_release release;
+                   // Ctrl-C would otherwise go unnoticed while spinning without the GIL
+                   batch = self.Pop(&arrival_ns, [] {
+                       nb::gil_scoped_acquire gil;
+                       if (PyErr_CheckSignals() != 0) {
+                           throw nb::python_error();
+                       }
+                   });
+               }
+               if (!batch) {
+                   return nb::none();
+               }
+               auto capsules = BatchCapsules(*batch);
+               return nb::make_tuple(capsules[0], capsules[1], arrival_ns);
+           },
+           "Spin until the next batch, returned as (arrow_schema, arrow_array, arrival_ns) with "
+           "arrival_ns on the time.monotonic_ns() clock; None at the end of the stream. Signal "
+           "handlers run about every 50 ms while waiting, so KeyboardInterrupt stops the wait")
+      .def("close", &BusyPollSource::Close,
+           "Stop the reader thread");
 }
@@ -0,0 +1,315 @@
+"""Round trips through ArrowStreamServer and fetch_stream over every transport.
+
+Run with ``pytest tests`` after installing the package with its ``test`` extra.
+"""
+import asyncio
+import contextlib
+import os
+import shutil
+import ssl
+import subprocess
+
+import pyarrow as pa
+import pyarrow.compute as pc
+import pytest
+from aiohttp import web
+
+from prototype import ArrowStreamServer, AsyncRecordBatchWriter, buffered_protocol, fetch_stream
+
+TABLE = pa.table({"i": pa.array(range(10_000), pa.int64()),
+                  "s": pa.array([f"row {i}" for i in range(10_000)])})
+BATCH_ROWS = 1_000
+
+
+def _ipc_bytes(table: pa.Table) -> bytes:
+    sink = pa.BufferOutputStream()
+    with pa.ipc.new_stream(sink, table.schema) as writer:
+        writer.write_table(table, max_chunksize=BATCH_ROWS)
+    return sink.getvalue().to_pybytes()
+
+
+async def _read_all(url: str, **kwargs) -> pa.Table:
+    reader = await fetch_stream(url, **kwargs)
+    return pa.Table.from_batches([batch async for batch in reader], schema=await reader.schema)
+
+
+async def _websocket(request: web.Request) -> web.WebSocketResponse:
+    """Send TABLE with one IPC message per binary frame"""
+    ws = web.WebSocketResponse()
+    await ws.prepare(request)
+    await ws.send_bytes(TABLE.schema.serialize().to_pybytes())
+    for batch in TABLE.to_batches(BATCH_ROWS):
+        await ws.send_bytes(batch.serialize().to_pybytes())
+    await ws.send_bytes(b"\xff\xff\xff\xff\x00\x00\x00\x00")
+    await ws.close()
+    return ws
+
+
+@contextlib.asynccontextmanager
+async def _serve(server: ArrowStreamServer, ssl_context: ssl.SSLContext = None):
+    """Run an app with the server's handlers on a free port; yields the base URL"""
+    async def stream(request: web.Request) -> web.StreamResponse:
+        return await server.stream(request, TABLE.to_batches(BATCH_ROWS))
+
+    async def upload(request: web.Request) -> web.Response:
+        """Cache the posted stream under the name in the path"""
+        table = pa.ipc.open_stream(await request.read()).read_all()
+        server.cache(request.match_info["name"], table)
+        return web.Response(status=201)
+
+    app = web.Application()
+    app.router.add_get("/stream", stream)
+    app.router.add_post("/upload/{name}", upload)
+    app.router.add_get("/cached/{name}", server.handle_cached)
+    app.router.add_get("/ws", _websocket)
+    runner = web.AppRunner(app)
+    await runner.setup()
+    site = web.TCPSite(runner, "127.0.0.1", 0, ssl_context=ssl_context)
+    await site.start()
+    try:
+        host, port = runner.addresses[0][:2]
+        yield f"{'https' if ssl_context else 'http'}://{host}:{port}"
+    finally:
+        await runner.cleanup()
+
+
+@pytest.fixture
+def server(tmp_path) -> ArrowStreamServer:
+    server = ArrowStreamServer(cache_dir=str(tmp_path))
+    server.cache("table", TABLE)
+    return server
+
+
+@pytest.fixture
+def certificate(tmp_path):
+    """Self-signed certificate for 127.0.0.1; yields (server context, client context)"""
+    if shutil.which("openssl") is None:
+        pytest.skip("needs the openssl command")
+    cert, key = str(tmp_path / "cert.pem"), str(tmp_path / "key.pem")
+    subprocess.run(["openssl", "req", "-x509", "-newkey", "ec", "-pkeyopt",
+                    "ec_paramgen_curve:prime256v1", "-nodes", "-days", "1", "-keyout", key,
+                    "-out", cert, "-subj", "/CN=127.0.0.1", "-addext",
+                    "subjectAltName=IP:127.0.0.1"], check=True, capture_output=True)
+    server_context = ssl.create_default_context(ssl.Purpose.CLIENT_AUTH)
+    server_context.load_cert_chain(cert, key)
+    return server_context, ssl.create_default_context(cafile=cert)
+
+
+@pytest.mark.parametrize("transport", ["aiohttp", "buffered"])
+@pytest.mark.parametrize("path", ["/stream", "/cached/table"])
+def test_http_roundtrip(server, transport, path):
+    async def main():
+        async with _serve(server) as base:
+            return await _read_all(base + path, transport=transport)
+
+    assert asyncio.run(main()).equals(TABLE)
+
+
+@pytest.mark.parametrize("compression", [None, "zstd"])
+def test_writer_roundtrip(server, compression):
+    async def main():
+        async with _serve(server) as base:
+            async with AsyncRecordBatchWriter(base + "/upload/uploaded", TABLE.schema,
+                                              compression=compression) as writer:
+                for batch in TABLE.to_batches(BATCH_ROWS):
+                    await writer.write(batch)
+            return await _read_all(base + "/cached/uploaded")
+
+    assert asyncio.run(main()).equals(TABLE)
+
+
+@pytest.mark.parametrize("prefix", ["file://", ""])
+def test_file_roundtrip(server, prefix):
+    path = server.cache("file", TABLE)
+    assert asyncio.run(_read_all(prefix + path)).equals(TABLE)
+
+
+@pytest.mark.parametrize("transport", ["aiohttp", "buffered"])
+def test_fields_and_filters(server, transport):
+    filters = [("i", ">=", 2_500), ("i", "<", 7_000), ("i", "!=", 3_000)]
+
+    async def main():
+        async with _serve(server) as base:
+            return await _read_all(base + "/stream", transport=transport, fields=["i"],
+                                   filters=filters)
+
+    i = TABLE["i"]
+    mask = pc.and_(pc.and_(pc.greater_equal(i, 2_500), pc.less(i, 7_000)), pc.not_equal(i, 3_000))
+    assert asyncio.run(main()).equals(TABLE.select(["i"]).filter(mask))
+
+
+@pytest.mark.parametrize("options", [
+    {"spill_threshold": 0},
+    {"spill_threshold": 0, "spill_compression": "zstd"},
+    {"compress_depth": 0},
+    {"spill_threshold": 2 * TABLE.slice(0, BATCH_ROWS).nbytes, "compress_depth": 1},
+])
+def test_queue_options_keep_batches(server, tmp_path, options):
+    """Spilled and compressed batches come back as sent, in order"""
+    async def main():
+        async with _serve(server) as base:
+            reader = await fetch_stream(base + "/stream", spill_dir=str(tmp_path), **options)
+            # Let the stream queue up before consuming it
+            await asyncio.sleep(0.1)
+            return [batch async for batch in reader]
+
+    batches = asyncio.run(main())
+    expected = TABLE.to_batches(BATCH_ROWS)
+    assert len(batches) == len(expected)
+    assert all(batch.equals(other) for batch, other in zip(batches, expected))
+
+
+@pytest.mark.parametrize("transport", ["aiohttp", "buffered"])
+def test_https_roundtrip(server, certificate, transport):
+    server_context, client_context = certificate
+
+    async def main():
+        async with _serve(server, server_context) as base:
+            return await _read_all(base + "/stream", transport=transport,
+                                   ssl_context=client_context, ktls=False)
+
+    assert asyncio.run(main()).equals(TABLE)
+
+
+def test_https_without_trusted_certificate(server, certificate):
+    async def main():
+        async with _serve(server, certificate[0]) as base:
+            await _read_all(base + "/stream", transport="buffered", ktls=False)
+
+    with pytest.raises(ssl.SSLCertVerificationError):
+        asyncio.run(main())
+
+
+def _spy_connect_ktls(monkeypatch) -> list:
+    """Record the sockets _connect_ktls returns"""
+    sockets = []
+    connect = buffered_protocol._connect_ktls
+
+    def spy(*args):
+        sockets.append(connect(*args))
+        return sockets[-1]
+
+    monkeypatch.setattr(buffered_protocol, "_connect_ktls", spy)
+    return sockets
+
+
+def test_https_ktls(server, certificate, monkeypatch):
+    if not buffered_protocol._kernel_has_tls():
+        pytest.skip("kernel has no TLS support")
+    sockets = _spy_connect_ktls(monkeypatch)
+    monkeypatch.setattr(buffered_protocol, "_ktls_refused", set())
+
+    async def main():
+        async with _serve(server, certificate[0]) as base:
+            return await _read_all(base + "/stream", transport="buffered",
+                                   ssl_context=certificate[1])
+
+    table = asyncio.run(main())
+    if not isinstance(sockets[0], buffered_protocol.KtlsSocket):
+        pytest.skip("OpenSSL did not hand the keys to the kernel")
+    assert table.equals(TABLE)
+
+
+def test_https_ktls_refused(server, certificate, monkeypatch):
+    # Pretend the kernel has TLS, and make the check for offloaded keys fail
+    monkeypatch.setattr(buffered_protocol, "_ktls_usable", True)
+    monkeypatch.setattr(buffered_protocol, "_TLS_RX", 0xdead)
+    monkeypatch.setattr(buffered_protocol, "_ktls_refused", set())
+    sockets = _spy_connect_ktls(monkeypatch)
+
+    async def main():
+        async with _serve(server, certificate[0]) as base:
+            first = await _read_all(base + "/stream", transport="buffered",
+                                    ssl_context=certificate[1])
+            second = await _read_all(base + "/cached/table", transport="buffered",
+                                     ssl_context=certificate[1])
+            return first, second
+
+    first, second = asyncio.run(main())
+    assert first.equals(TABLE) and second.equals(TABLE)
+    # The handshake was kept on the first connection; the second did not try kernel TLS
+    assert len(sockets) == 1 and isinstance(sockets[0], ssl.SSLSocket)
+    assert [host for host, _ in buffered_protocol._ktls_refused] == ["127.0.0.1"]
+
+
+def test_websocket_roundtrip(server):
+    async def main():
+        async with _serve(server) as base:
+            return await _read_all(base.replace("http", "ws", 1) + "/ws")
+
+    assert asyncio.run(main()).equals(TABLE)
+
+
+def test_h2_roundtrip():
+    pytest.importorskip("h2")
+    import h2.config
+    import h2.connection
+    import h2.events
+
+    body = _ipc_bytes(TABLE)
+
+    async def handle(reader: asyncio.StreamReader, writer: asyncio.StreamWriter):
+        conn = h2.connection.H2Connection(h2.config.H2Configuration(client_side=False))
+        conn.initiate_connection()
+        writer.write(conn.data_to_send())
+        pending = {}   # stream id -> bytes sent so far
+        while data := await reader.read(65536):
+            for event in conn.receive_data(data):
+                if isinstance(event, h2.events.RequestReceived):
+                    conn.send_headers(event.stream_id, [(":status", "200")])
+                    pending[event.stream_id] = 0
+            # Send as much as the client's flow-control windows allow
+            for stream_id, offset in list(pending.items()):
+                while offset < len(body):
+                    size = min(conn.local_flow_control_window(stream_id),
+                               conn.max_outbound_frame_size, len(body) - offset)
+                    if size <= 0:
+                        break
+                    conn.send_data(stream_id, body[offset:offset + size])
+                    offset += size
+                pending[stream_id] = offset
+                if offset == len(body):
+                    conn.end_stream(stream_id)
+                    del pending[stream_id]
+            writer.write(conn.data_to_send())
+        writer.close()
+
+    async def main():
+        h2_server = await asyncio.start_server(handle, "127.0.0.1", 0)
+        port = h2_server.sockets[0].getsockname()[1]
+        try:
+            url = f"http://127.0.0.1:{port}/stream"
+            return await asyncio.gather(*(_read_all(url, transport="h2") for _ in range(3)))
+        finally:
+            h2_server.close()
+
+    for table in asyncio.run(main()):
+        assert table.equals(TABLE)
+
+
+def test_cache_replaces_previous_file(server, tmp_path):
+    first = server.cache("other", TABLE.slice(0, 10))
+    second = server.cache("other", TABLE.slice(0, 20))
+    assert first != second
+    assert not os.path.exists(first)
+    assert len(os.listdir(tmp_path)) == 2   # "table" and the second "other"
+
+    async def main():
+        async with _serve(server) as base:
+            return await _read_all(base + "/cached/other")
+
+    assert asyncio.run(main()).equals(TABLE.slice(0, 20))
+
+
+def test_cached_missing_name(server):
+    async def main():
+        async with _serve(server) as base:
+            await _read_all(base + "/cached/missing", transport="buffered")
+
+    with pytest.raises(RuntimeError, match="404"):
+        asyncio.run(main())
+
+
+def test_stream_empty_source_needs_schema(server):
+    with pytest.raises(ValueError, match="schema is required"):
+        asyncio.run(server.stream(None, []))